@@ -0,0 +1,295 @@
+// every engine on every sample and synthetic program, as CSV
+//   $ make bench
+//   $ bench/bench [-runs=<n>] [-timeout=<s>] [-engines=<a,b,...>]
+//         [-cell8|-cell16|-cell32] [program...]
+// wall, time to first byte, compile and jit time are medians over the
+// runs, peak RSS the maximum. A -cell option is passed to the engines that
+// take one, the others are skipped. The output checksum must match across
+// engines; the exit status is 1 when one does not, or fails or times out.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+#define TIMEOUT 60
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+struct Engine {
+    const char *name;
+    // bf-jit and bf-vm-opt read the program from stdin
+    bool from_stdin;
+    // takes -cell8, -cell16 and -cell32
+    bool cells;
+};
+const Engine ENGINES[] = {
+    { "bf-jit", true, false },
+    { "bf-vm-opt", true, true },
+    { "bf-jit-opt", false, true },
+    { "bf-tier", false, true },
+};
+struct Program {
+    std::string name, path;
+};
+// synthetic programs
+std::string repeat(const std::string &s, int n) {
+    std::string result;
+    for (int i = 0; i < n; ++i)
+        result += s;
+    return result;
+}
+// s(n) back and forth over 20000 cells, 2000 times
+std::string scan_program() {
+    return repeat("+", 200) + ">>" + repeat("+>", 20000) + "<[<]<" +
+        "[>>[>]<[<]<-]++++++++++[>+++++<-]>+.";
+}
+// a multiplier loop under three generic loops, 8 million times
+std::string linear_program() {
+    std::string n = repeat("+", 200);
+    return n + "[>" + n + "[>" + n + "[>+++[>+>++>+++<<<-]<-]<-]<-]>>>>.>.>.";
+}
+// 2.56 MB of output
+std::string output_program() {
+    std::string n = repeat("+", 40);
+    return n + "[>" + n + "[>" + n + "[>" + n + "[.-]<-]<-]<-]";
+}
+// a cell moved 40000 cells to the right, further than a 16-bit offset
+std::string offset_program() {
+    std::string far = repeat(">", 40000), back = repeat("<", 40000);
+    return "+++[-" + far + "+" + back + "]" + far + repeat("+", 50) + ".";
+}
+struct Run {
+    bool ok, timeout;
+    double wall, ttfb, compile, jit;
+    long rss;
+    uint64_t checksum;
+};
+// runs engine on program once, stdout is hashed with FNV-1a and the
+// -stats line read from stderr; cell is NULL or a -cell option
+void run_once(const Engine &engine, const Program &program, const char *cell, double timeout, Run &run) {
+    int out[2], err[2];
+    if (pipe(out) != 0 || pipe(err) != 0) {
+        perror("pipe");
+        exit(2);
+    }
+    std::string path = std::string("./") + engine.name;
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int in = open(engine.from_stdin ? program.path.c_str() : "/dev/null", O_RDONLY);
+        dup2(in, 0);
+        dup2(out[1], 1);
+        dup2(err[1], 2);
+        close(out[0]);
+        close(err[0]);
+        std::vector<const char*> args(1, engine.name);
+        if (!engine.from_stdin)
+            args.push_back(program.path.c_str());
+        args.push_back("-stats");
+        if (cell != NULL)
+            args.push_back(cell);
+        args.push_back(NULL);
+        execv(path.c_str(), (char**) &args[0]);
+        _exit(127);
+    }
+    close(out[1]);
+    close(err[1]);
+    run.ok = run.timeout = false;
+    run.ttfb = run.compile = run.jit = -1;
+    run.checksum = 14695981039346656037ULL;
+    std::string stats;
+    struct pollfd fds[2] = { { out[0], POLLIN, 0 }, { err[0], POLLIN, 0 } };
+    int open_fds = 2;
+    char buf[65536];
+    while (open_fds > 0) {
+        int left = (int) (start + timeout * 1e3 - now());
+        if (left <= 0 || poll(fds, 2, left) == 0) {
+            kill(pid, SIGKILL);
+            run.timeout = true;
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                --open_fds;
+            } else if (i == 0) {
+                if (run.ttfb < 0)
+                    run.ttfb = now() - start;
+                for (ssize_t j = 0; j < n; ++j)
+                    run.checksum = (run.checksum ^ (unsigned char) buf[j]) * 1099511628211ULL;
+            } else {
+                stats.append(buf, n);
+            }
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+    }
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    run.wall = now() - start;
+    run.rss = usage.ru_maxrss;
+    run.ok = !run.timeout && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    const char *compile = strstr(stats.c_str(), "compile: ");
+    if (compile != NULL)
+        run.compile = atof(compile + 9);
+    const char *jit = strstr(stats.c_str(), "jit: ");
+    if (jit != NULL)
+        run.jit = atof(jit + 5);
+}
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values.empty() ? -1 : values[values.size() / 2];
+}
+int main(int argc, char *argv[]) {
+    int runs = RUNS;
+    double timeout = TIMEOUT;
+    std::string engines;
+    const char *cell = NULL;
+    std::vector<Program> programs;
+    for (int i = 1; i < argc; ++i) {
+        const char *option = argv[i];
+        if (strncmp(option, "-runs=", 6) == 0) {
+            runs = atoi(option + 6);
+        } else if (strncmp(option, "-timeout=", 9) == 0) {
+            timeout = atof(option + 9);
+        } else if (strncmp(option, "-engines=", 9) == 0) {
+            engines = std::string(",") + (option + 9) + ",";
+        } else if (strcmp(option, "-cell8") == 0 || strcmp(option, "-cell16") == 0 ||
+                strcmp(option, "-cell32") == 0) {
+            cell = option;
+        } else {
+            Program program;
+            program.path = option;
+            program.name = strrchr(option, '/') != NULL ? strrchr(option, '/') + 1 : option;
+            programs.push_back(program);
+        }
+    }
+    char dir[] = "/tmp/bf-bench.XXXXXX";
+    if (programs.empty()) {
+        const char *samples[] = {
+            "hello.bf", "long.b", "mandelbrot.b", "mandelbrot-huge.b", "mandelbrot-titannic.b",
+        };
+        for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i) {
+            Program program;
+            program.name = samples[i];
+            program.path = std::string("sample/") + samples[i];
+            programs.push_back(program);
+        }
+        if (mkdtemp(dir) == NULL) {
+            perror("mkdtemp");
+            return 2;
+        }
+        const char *names[] = {
+            "synthetic-scan.b", "synthetic-linear.b", "synthetic-output.b", "synthetic-offset.b",
+        };
+        std::string sources[] = { scan_program(), linear_program(), output_program(), offset_program() };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+            Program program;
+            program.name = names[i];
+            program.path = std::string(dir) + "/" + names[i];
+            FILE *file = fopen(program.path.c_str(), "w");
+            fputs(sources[i].c_str(), file);
+            fclose(file);
+            programs.push_back(program);
+        }
+    } else {
+        dir[0] = '\0';
+    }
+
+    bool mismatch = false, failed = false;
+    printf("engine,program,runs,status,checksum,compile_ms,jit_ms,ttfb_ms,wall_ms,wall_min_ms,peak_rss_kb\n");
+    for (size_t p = 0; p < programs.size(); ++p) {
+        const Program &program = programs[p];
+        bool has_expected = false;
+        uint64_t expected = 0;
+        for (size_t e = 0; e < sizeof(ENGINES) / sizeof(ENGINES[0]); ++e) {
+            const Engine &engine = ENGINES[e];
+            if (!engines.empty() && engines.find(std::string(",") + engine.name + ",") == std::string::npos)
+                continue;
+            if (access(engine.name, X_OK) != 0) {
+                printf("%s,%s,0,missing,,,,,,,\n", engine.name, program.name.c_str());
+                fflush(stdout);
+                continue;
+            }
+            if (cell != NULL && !engine.cells)
+                continue;
+            std::vector<double> wall, ttfb, compile, jit;
+            const char *status = "ok";
+            uint64_t checksum = 0;
+            long rss = 0;
+            int done = 0;
+            for (; done < runs; ++done) {
+                Run run;
+                run_once(engine, program, cell, timeout, run);
+                if (!run.ok) {
+                    status = run.timeout ? "timeout" : "failed";
+                    failed = true;
+                    ++done;
+                    break;
+                }
+                if (done > 0 && run.checksum != checksum)
+                    status = "unstable";
+                checksum = run.checksum;
+                rss = std::max(rss, run.rss);
+                wall.push_back(run.wall);
+                ttfb.push_back(run.ttfb);
+                if (run.compile >= 0)
+                    compile.push_back(run.compile);
+                if (run.jit >= 0)
+                    jit.push_back(run.jit);
+            }
+            if (strcmp(status, "ok") == 0) {
+                if (!has_expected) {
+                    expected = checksum;
+                    has_expected = true;
+                } else if (checksum != expected) {
+                    status = "mismatch";
+                    mismatch = true;
+                }
+            }
+            printf("%s,%s,%d,%s,", engine.name, program.name.c_str(), done, status);
+            if (!wall.empty()) {
+                printf("%016llx,", (unsigned long long) checksum);
+                if (!compile.empty())
+                    printf("%.3f", median(compile));
+                printf(",");
+                if (!jit.empty())
+                    printf("%.3f", median(jit));
+                printf(",%.3f,%.3f,%.3f,%ld\n", median(ttfb), median(wall),
+                        *std::min_element(wall.begin(), wall.end()), rss);
+            } else {
+                printf(",,,,,,\n");
+            }
+            fflush(stdout);
+        }
+    }
+    if (dir[0] != '\0') {
+        for (size_t p = 0; p < programs.size(); ++p) {
+            if (programs[p].path.compare(0, strlen(dir), dir) == 0)
+                unlink(programs[p].path.c_str());
+        }
+        rmdir(dir);
+    }
+    return mismatch || failed ? 1 : 0;
+}
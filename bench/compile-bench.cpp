@@ -0,0 +1,135 @@
+// compile time vs program size: generated programs from 1 KB up to
+// -max=<bytes> (default 1 GB), each four times the last, are parsed,
+// optimized and lowered in-process
+//   $ make bench/compile-bench && bench/compile-bench [-max=<bytes>]
+// Sizes from 1 MB on are compared with the time per byte at 1 MB and
+// reported superlinear over twice that; the exit status is 1 then. Sizes
+// that would need more than 3/4 of the physical memory, going by the peak
+// RSS of the last one, are skipped.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "../bf-ir.h"
+#include "../bf-lex.h"
+
+#define MIN_SIZE 1024
+#define BASELINE_SIZE (1 << 20)
+#define MAX_SIZE (1 << 30)
+// runs of small sizes until this many bytes were compiled
+#define REPEAT_BYTES (64 << 20)
+
+uint32_t state = 1;
+uint32_t next_random() {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+// what machine-generated sources look like: comments, long runs, the
+// usual loop idioms, and loops nested as deep as a sixteenth of the
+// pieces; every loop is entered with a cell that may be nonzero
+const char *PIECES[] = {
+    "; move the carry to the next digit and clear the scratch cells\n",
+    "; compare the two bytes and leave the flag two cells to the right\n",
+    "; emitted by the code generator, do not edit\n",
+    "        ; unrolled copy of the input buffer into the work area\n",
+    "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++",
+    "----------------------------------------------------------------",
+    ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>", "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<",
+    "+[-]", "+[->+<]", "+[->>+++<<]", "+[>]", "+[<<]", "+[->++<]>.", "+[>+<-[>>]<]",
+};
+void generate(FILE *out, size_t size) {
+    const size_t count = sizeof(PIECES) / sizeof(PIECES[0]);
+    std::string text = ",";
+    size_t written = 0, pieces = 0, depth = 0;
+    while (written + text.size() + depth < size) {
+        text += PIECES[next_random() % count];
+        // opening in the first half, closing in the second
+        if (++pieces % 8 == 0) {
+            if (written + text.size() < size / 2) {
+                text += "+[+";
+                ++depth;
+            } else if (depth > 0) {
+                text += "]";
+                --depth;
+            }
+        }
+        if (text.size() >= 65536) {
+            fwrite(text.data(), 1, text.size(), out);
+            written += text.size();
+            text.clear();
+        }
+    }
+    text.append(depth, ']');
+    fwrite(text.data(), 1, text.size(), out);
+}
+int main(int argc, char *argv[]) {
+    size_t max = MAX_SIZE;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-max=", 5) == 0)
+            max = strtoull(argv[i] + 5, NULL, 10);
+    }
+    char path[] = "/tmp/bf-compile-bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 2;
+    }
+    close(fd);
+    bool superlinear = false;
+    double baseline = 0;
+    long memory_kb = sysconf(_SC_PHYS_PAGES) * (sysconf(_SC_PAGESIZE) / 1024);
+    long peak_kb = 0;
+    printf("bytes,instructions,runs,compile_ms,ns_per_byte,peak_rss_kb,status\n");
+    for (size_t size = MIN_SIZE; size <= max; size *= 4) {
+        if (peak_kb * 4 > memory_kb / 4 * 3) {
+            printf("%zu,,,,,,skipped\n", size);
+            continue;
+        }
+        FILE *file = fopen(path, "w+");
+        state = 1;
+        generate(file, size);
+        fflush(file);
+        rewind(file);
+        int runs = size < REPEAT_BYTES ? REPEAT_BYTES / size : 1;
+        if (runs > 100)
+            runs = 100;
+        double best = 0;
+        size_t instructions = 0;
+        for (int run = 0; run < runs; ++run) {
+            rewind(file);
+            double start = now();
+            {
+                Source source(file);
+                PassManager passes;
+                std::vector<Instruction> insns;
+                Snapshot<uint8_t> snapshot;
+                compile<uint8_t>(insns, snapshot, source, passes);
+                instructions = insns.size();
+            }
+            double elapsed = now() - start;
+            if (run == 0 || elapsed < best)
+                best = elapsed;
+        }
+        fclose(file);
+        double per_byte = best * 1e6 / size;
+        const char *status = "ok";
+        if (size == BASELINE_SIZE)
+            baseline = per_byte;
+        if (size > BASELINE_SIZE && per_byte > 2 * baseline) {
+            status = "superlinear";
+            superlinear = true;
+        }
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak_kb = usage.ru_maxrss;
+        printf("%zu,%zu,%d,%.3f,%.3f,%ld,%s\n", size, instructions, runs, best, per_byte, peak_kb, status);
+        fflush(stdout);
+    }
+    unlink(path);
+    return superlinear ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+// the VM dispatchers (bf-dispatch.h) on every program: median wall time
+// and, where perf_event_open() is allowed, the instructions, branches and
+// branch misses of the runs, one CSV line per program and dispatcher
+//   $ make bench/dispatch-bench && bench/dispatch-bench [-runs=<n>] [-no-super]
+//         [-dispatch=<a,b,...>] [program...]
+// Programs default to the samples up to mandelbrot.b. Input is /dev/null
+// and the output is hashed; the exit status is 1 when the dispatchers do
+// not agree on it.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include "../bf-dispatch.h"
+#include "../bf-io.h"
+#include "../bf-ir.h"
+#include "../bf-lex.h"
+#include "../bf-tape.h"
+
+#define RUNS 3
+
+typedef uint32_t Cell;
+
+const char *DEFAULT_PROGRAMS[] = {
+    "sample/hello.bf", "sample/long.b", "sample/mandelbrot.b",
+};
+enum Counter {
+    INSTRUCTIONS, BRANCHES, BRANCH_MISSES, COUNTERS
+};
+const uint64_t COUNTER_CONFIGS[] = {
+    PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+};
+// hardware counters of this thread in user mode; fds are -1 where the
+// kernel or the machine does not have them
+struct Counters {
+    int fds[COUNTERS];
+    Counters() {
+        for (int i = 0; i < COUNTERS; ++i) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = COUNTER_CONFIGS[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+    ~Counters() {
+        for (int i = 0; i < COUNTERS; ++i) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+    }
+    void start() {
+        for (int i = 0; i < COUNTERS; ++i) {
+            if (fds[i] >= 0) {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+    // the counts since start(), -1 for the ones there are not
+    void stop(int64_t *counts) {
+        for (int i = 0; i < COUNTERS; ++i) {
+            counts[i] = -1;
+            if (fds[i] < 0)
+                continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t n;
+            if (read(fds[i], &n, sizeof(n)) == sizeof(n))
+                counts[i] = n;
+        }
+    }
+};
+long hash_output(void *context, const void *buf, size_t n) {
+    uint64_t &hash = *(uint64_t*) context;
+    for (size_t i = 0; i < n; ++i)
+        hash = (hash ^ ((const unsigned char*) buf)[i]) * 1099511628211ULL;
+    return n;
+}
+template <typename T>
+T median(std::vector<T> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+// one run of insns with dispatch, returns the wall time in ms
+double run_once(Dispatch dispatch, bool super, const std::vector<Instruction> &insns,
+        const Snapshot<Cell> &snapshot, Counters &counters, int64_t *counts, uint64_t &hash) {
+    std::vector<IO> io(1);
+    io_init(&io[0], FLUSH_FULL);
+    io[0].in_fd = open("/dev/null", O_RDONLY);
+    io[0].writer = hash_output;
+    io[0].context = &hash;
+    Tape tape(30000 * sizeof(Cell), false, false);
+    Cell *head = snapshot.restore((Cell*) tape.head());
+    io_write(&io[0], snapshot.output.data(), snapshot.output.size());
+    counters.start();
+    double start = now();
+    execute_dispatch<Cell>(dispatch, insns, snapshot.pc, head, &io[0], super);
+    double wall = now() - start;
+    counters.stop(counts);
+    close(io[0].in_fd);
+    return wall;
+}
+// the dispatchers in the comma separated list names
+void select_dispatches(const char *names, std::vector<bool> &selected) {
+    selected.assign(DISPATCHES, false);
+    std::string list = names;
+    for (size_t from = 0; from <= list.size();) {
+        size_t to = list.find(',', from);
+        if (to == std::string::npos)
+            to = list.size();
+        Dispatch dispatch;
+        if (parse_dispatch(list.substr(from, to - from).c_str(), dispatch))
+            selected[dispatch] = true;
+        else
+            fprintf(stderr, "unknown dispatch: %s\n", list.substr(from, to - from).c_str());
+        from = to + 1;
+    }
+}
+int main(int argc, char *argv[]) {
+    int runs = RUNS;
+    bool super = true;
+    std::vector<bool> dispatches(DISPATCHES, true);
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-runs=", 6) == 0)
+            runs = std::max(1, atoi(argv[i] + 6));
+        else if (strcmp(argv[i], "-no-super") == 0)
+            super = false;
+        else if (strncmp(argv[i], "-dispatch=", 10) == 0)
+            select_dispatches(argv[i] + 10, dispatches);
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty())
+        paths.assign(DEFAULT_PROGRAMS, DEFAULT_PROGRAMS + sizeof(DEFAULT_PROGRAMS) / sizeof(DEFAULT_PROGRAMS[0]));
+    Counters counters;
+    if (counters.fds[BRANCH_MISSES] < 0)
+        fprintf(stderr, "perf_event_open: no branch counters, only times are reported\n");
+    int status = 0;
+    printf("program,dispatch,runs,checksum,wall_ms,wall_min_ms,instructions,branches,branch_misses,miss_pct\n");
+    for (size_t p = 0; p < paths.size(); ++p) {
+        FILE *file = fopen(paths[p], "r");
+        if (file == NULL) {
+            perror(paths[p]);
+            status = 1;
+            continue;
+        }
+        std::vector<Instruction> insns;
+        Snapshot<Cell> snapshot;
+        PassManager passes;
+        compile<Cell>(insns, snapshot, Source(file), passes);
+        fclose(file);
+        uint64_t expected = 0;
+        bool first = true;
+        for (int d = 0; d < DISPATCHES; ++d) {
+            if (!dispatches[d])
+                continue;
+            std::vector<double> walls;
+            std::vector<int64_t> counts[COUNTERS];
+            uint64_t hash = 0;
+            for (int r = 0; r < runs; ++r) {
+                int64_t run_counts[COUNTERS];
+                hash = 14695981039346656037ULL;
+                walls.push_back(run_once((Dispatch) d, super, insns, snapshot, counters, run_counts, hash));
+                for (int c = 0; c < COUNTERS; ++c)
+                    counts[c].push_back(run_counts[c]);
+            }
+            if (first)
+                expected = hash;
+            else if (hash != expected)
+                status = 1;
+            first = false;
+            printf("%s,%s,%d,%016llx,%.3f,%.3f", paths[p], DISPATCH_NAMES[d], runs,
+                    (unsigned long long) hash, median(walls), *std::min_element(walls.begin(), walls.end()));
+            for (int c = 0; c < COUNTERS; ++c) {
+                if (median(counts[c]) >= 0)
+                    printf(",%lld", (long long) median(counts[c]));
+                else
+                    printf(",");
+            }
+            if (median(counts[BRANCHES]) > 0 && median(counts[BRANCH_MISSES]) >= 0)
+                printf(",%.3f\n", 100.0 * median(counts[BRANCH_MISSES]) / median(counts[BRANCHES]));
+            else
+                printf(",\n");
+        }
+    }
+    if (status != 0)
+        fprintf(stderr, "dispatchers disagree or a program is missing\n");
+    return status;
+}
@@ -0,0 +1,61 @@
+// SEARCH_ZERO kernels: scan length vs throughput
+//   $ make bench/scan-bench && bench/scan-bench
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include "../bf-scan.h"
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+template <typename Cell>
+void bench(const char *name, ScanFunc func, int stride, size_t length) {
+    const size_t margin = 64;
+    std::vector<Cell> buf(length * std::abs(stride) + 2 * margin, 1);
+    Cell *origin = &buf[margin];
+    if (stride < 0)
+        origin += length * -stride;
+    Cell *zero = origin + (long) length * stride;
+    *zero = 0;
+    // also check against the scalar loop
+    if (func(origin, stride) != zero || scan_scalar<Cell>(origin, stride) != zero) {
+        fprintf(stderr, "%s: wrong result for stride %d length %zu\n", name, stride, length);
+        exit(1);
+    }
+    size_t repeat = 1 + (1 << 24) / (length + 1);
+    double start = now();
+    void *sink = NULL;
+    for (size_t i = 0; i < repeat; ++i)
+        sink = func(origin, stride);
+    double ns = (now() - start) / repeat;
+    printf("%-6s %2d-bit %3d %9zu %12.1f %8.3f\n", name, (int) sizeof(Cell) * 8, stride, length,
+            ns, ns > 0 ? length / ns : 0.0);
+    (void) sink;
+}
+template <typename Cell>
+void bench_cell() {
+    const int strides[] = { 1, -1, 2, -2, 4, -4 };
+    for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); ++s) {
+        int stride = strides[s];
+        ScanFunc vector = select_scan<Cell>(stride);
+        for (size_t length = 1; length <= (1 << 20); length *= 16) {
+            bench<Cell>("scalar", scan_scalar<Cell>, stride, length);
+            if (vector == scan_sse2<Cell> || vector == scan_avx2<Cell>)
+                bench<Cell>("sse2", scan_sse2<Cell>, stride, length);
+            if (vector == scan_avx2<Cell>)
+                bench<Cell>("avx2", scan_avx2<Cell>, stride, length);
+        }
+    }
+}
+int main() {
+    printf("kernel  cell stride length ns/scan cells/ns\n");
+    bench_cell<uint8_t>();
+    bench_cell<uint16_t>();
+    bench_cell<uint32_t>();
+    return 0;
+}
@@ -0,0 +1,268 @@
+// trains the superinstructions of the VM and writes bf-super-table.h
+//   $ make superinstructions
+//   $ bench/super-gen [-count=<n>] [-held-out=<program>]... program... > bf-super-table.h
+// Every program is optimized as bf-vm-opt does it and run to its end by a
+// counting interpreter, with , at EOF. The sequences of up to SUPER_MAX
+// instructions that save the most dispatches are picked one at a time,
+// each time the one that saves the most with the picked ones in place.
+// The programs are then run again with them, counting dispatches the way
+// execute() dispatches, and the dispatches without and with them are
+// reported on stderr and in the header, apart for the -held-out programs,
+// which are only run with the table and not trained on.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "../bf-ir.h"
+#include "../bf-lex.h"
+#include "../bf-super.h"
+#include "../bf-tape.h"
+
+#define TABLE_SIZE 16
+// sequences, by dispatches saved alone, the picks are made from
+#define CANDIDATES 128
+
+typedef uint32_t Cell;
+
+struct Trained {
+    std::string path;
+    std::vector<Instruction> insns;
+    Snapshot<Cell> snapshot;
+    // times insns[pc] ran
+    std::vector<uint64_t> counts;
+    uint64_t dispatches, fused;
+};
+// runs program to END; counts how often each instruction ran when counts
+// is not NULL, returns the dispatches execute() would make with the
+// superinstructions starts assigns (assign_supers())
+uint64_t trace(const Trained &program, const Superinstruction *table,
+        const std::vector<int> &starts, std::vector<uint64_t> *counts) {
+    const std::vector<Instruction> &insns = program.insns;
+    Tape tape(30000 * sizeof(Cell), true, false);
+    Cell *mem = program.snapshot.restore((Cell*) tape.head());
+    Cell mult = 0;
+    uint64_t dispatches = 0;
+    // instructions left of the superinstruction running
+    int left = 0;
+    for (size_t pc = program.snapshot.pc; insns[pc].op != END; ++pc) {
+        const Instruction &insn = insns[pc];
+        if (counts != NULL)
+            ++(*counts)[pc];
+        if (left > 0) {
+            --left;
+        } else {
+            ++dispatches;
+            if (!starts.empty() && starts[pc] != 0)
+                left = table[starts[pc] - 1].length - 1;
+        }
+        switch (insn.op) {
+        case GET:
+            mem[insn.offset] = -1;
+            break;
+        case OPEN:
+            if (mem[insn.offset] == 0) {
+                pc += insn.value.i1;
+                left = 0;
+            }
+            break;
+        case CLOSE:
+            pc -= insn.value.i1;
+            left = 0;
+            break;
+        case CALC:
+            mem[insn.offset] += insn.value.i1;
+            break;
+        case MOVE:
+            mem += insn.value.i1;
+            break;
+        case LOAD:
+            mem[insn.offset] = insn.value.i1;
+            break;
+        case SEARCH_ZERO:
+            while (*mem != 0)
+                mem += insn.value.i1;
+            break;
+        case SET_MULTIPLIER:
+            mult = mem[insn.offset] * (Cell) insn.value.i1;
+            mem[insn.offset] = 0;
+            break;
+        case CALC_MULT:
+            mem[insn.offset] += mult * (Cell) insn.value.i1;
+            break;
+        case MEM_MOVE:
+            mem[insn.offset + insn.value.s2.s0] += mem[insn.offset] * (Cell) insn.value.s2.s1;
+            mem[insn.offset] = 0;
+            break;
+        default:
+            break;
+        }
+    }
+    // END
+    return dispatches + 1;
+}
+// opcodes of a sequence, as a map key
+typedef std::vector<int> Key;
+// dispatches of all programs with table, going by how often every
+// instruction ran: the ones inside a superinstruction are free
+uint64_t estimate(const std::vector<Trained> &programs, const std::vector<Superinstruction> &table) {
+    uint64_t total = 0;
+    std::vector<int> starts;
+    for (size_t p = 0; p < programs.size(); ++p) {
+        const Trained &program = programs[p];
+        assign_supers(program.insns, table.empty() ? NULL : &table[0], table.size(), starts);
+        for (size_t pc = 0; pc < starts.size();) {
+            total += program.counts[pc];
+            pc += starts[pc] != 0 ? table[starts[pc] - 1].length : 1;
+        }
+    }
+    return total;
+}
+// the CANDIDATES sequences that save the most dispatches alone
+void candidates(const std::vector<Trained> &programs, std::vector<Superinstruction> &result) {
+    std::map<Key, uint64_t> saved;
+    for (size_t p = 0; p < programs.size(); ++p) {
+        const std::vector<Instruction> &insns = programs[p].insns;
+        const std::vector<uint64_t> &counts = programs[p].counts;
+        for (size_t pc = 0; pc < insns.size(); ++pc) {
+            Key key;
+            uint64_t runs = counts[pc];
+            for (int n = 1; n <= SUPER_MAX && pc + n <= insns.size(); ++n) {
+                Opcode op = insns[pc + n - 1].op;
+                if (!fusable(op, n - 1, n))
+                    break;
+                key.push_back(op);
+                // runs through the whole sequence
+                runs = std::min(runs, counts[pc + n - 1]);
+                if (n > 1)
+                    saved[key] += runs * (n - 1);
+                if (op == CLOSE)
+                    break;
+            }
+        }
+    }
+    std::vector<std::pair<uint64_t, Key> > ranked;
+    for (std::map<Key, uint64_t>::iterator it = saved.begin(); it != saved.end(); ++it)
+        ranked.push_back(std::make_pair(it->second, it->first));
+    std::sort(ranked.rbegin(), ranked.rend());
+    for (size_t i = 0; i < ranked.size() && i < CANDIDATES; ++i) {
+        Superinstruction super;
+        memset(&super, 0, sizeof(super));
+        super.length = ranked[i].second.size();
+        for (int j = 0; j < super.length; ++j)
+            super.ops[j] = (Opcode) ranked[i].second[j];
+        result.push_back(super);
+    }
+}
+const char *OP_MACROS[] = {
+    "GET", "PUT", "OPEN", "CLOSE", "END",
+    "CALC", "MOVE", "LOAD", "SEARCH_ZERO",
+    "SET_MULTIPLIER", "CALC_MULT", "MEM_MOVE",
+};
+void write_savings(FILE *out, const char *title, const std::vector<Trained> &programs) {
+    if (programs.empty())
+        return;
+    fprintf(out, "// %s\n", title);
+    for (size_t p = 0; p < programs.size(); ++p) {
+        const Trained &program = programs[p];
+        fprintf(out, "//   %-28s %14llu -> %14llu  (-%.1f%%)\n", program.path.c_str(),
+                (unsigned long long) program.dispatches, (unsigned long long) program.fused,
+                100.0 * (program.dispatches - program.fused) / program.dispatches);
+    }
+}
+void write_table(FILE *out, const std::vector<Trained> &programs, const std::vector<Trained> &held_out,
+        const std::vector<Superinstruction> &table) {
+    fprintf(out, "// generated by bench/super-gen (make superinstructions), do not edit\n//\n");
+    fprintf(out, "// dispatches without and with these superinstructions\n");
+    write_savings(out, "on the held-out programs, not trained on:", held_out);
+    write_savings(out, "on the training programs, which the table is fitted to:", programs);
+    fprintf(out, "#ifndef BF_SUPER_TABLE_H\n#define BF_SUPER_TABLE_H\n\n#include \"bf-super.h\"\n\n");
+    fprintf(out, "#define SUPER_COUNT %zu\n", table.size());
+    fprintf(out, "const Superinstruction SUPERINSTRUCTIONS[] = {\n");
+    for (size_t s = 0; s < table.size(); ++s) {
+        fprintf(out, "    { %d, {", table[s].length);
+        for (int i = 0; i < table[s].length; ++i)
+            fprintf(out, " %s%s", OP_MACROS[table[s].ops[i]], i + 1 < table[s].length ? "," : " } },\n");
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "#define SUPER_LABELS");
+    for (size_t s = 0; s < table.size(); ++s)
+        fprintf(out, " \\\n    &&LABEL_SUPER_%zu%s", s, s + 1 < table.size() ? "," : "");
+    fprintf(out, "\n#define SUPER_HANDLERS");
+    for (size_t s = 0; s < table.size(); ++s) {
+        const Superinstruction &super = table[s];
+        fprintf(out, " \\\nLABEL_SUPER_%zu:", s);
+        for (int i = 0; i < super.length; ++i)
+            fprintf(out, " \\\n    SUPER_%s", OP_MACROS[super.ops[i]]);
+        if (super.ops[super.length - 1] != CLOSE)
+            fprintf(out, " \\\n    SUPER_NEXT");
+    }
+    fprintf(out, "\n\n#endif\n");
+}
+int main(int argc, char *argv[]) {
+    size_t count = TABLE_SIZE;
+    std::vector<Trained> programs, held_out;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-count=", 7) == 0) {
+            count = atoi(argv[i] + 7);
+            continue;
+        }
+        bool held = strncmp(argv[i], "-held-out=", 10) == 0;
+        const char *path = held ? argv[i] + 10 : argv[i];
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            perror(path);
+            return 2;
+        }
+        std::vector<Trained> &set = held ? held_out : programs;
+        set.push_back(Trained());
+        Trained &program = set.back();
+        program.path = path;
+        PassManager passes;
+        compile<Cell>(program.insns, program.snapshot, Source(file), passes);
+        fclose(file);
+        program.counts.assign(program.insns.size(), 0);
+        program.dispatches = trace(program, NULL, std::vector<int>(), &program.counts);
+    }
+    std::vector<Superinstruction> pool, table;
+    candidates(programs, pool);
+    uint64_t cost = estimate(programs, table);
+    while (table.size() < count) {
+        size_t best = pool.size();
+        uint64_t best_cost = cost;
+        for (size_t c = 0; c < pool.size(); ++c) {
+            table.push_back(pool[c]);
+            uint64_t with = estimate(programs, table);
+            table.pop_back();
+            if (with < best_cost) {
+                best = c;
+                best_cost = with;
+            }
+        }
+        if (best == pool.size())
+            break;
+        table.push_back(pool[best]);
+        pool.erase(pool.begin() + best);
+        cost = best_cost;
+    }
+    std::vector<int> starts;
+    std::vector<Trained> *sets[] = { &held_out, &programs };
+    fprintf(stderr, "%-28s %14s %14s %8s\n", "program", "dispatches", "fused", "removed");
+    for (int s = 0; s < 2; ++s) {
+        for (size_t p = 0; p < sets[s]->size(); ++p) {
+            Trained &program = (*sets[s])[p];
+            assign_supers(program.insns, table.empty() ? NULL : &table[0], table.size(), starts);
+            program.fused = trace(program, table.empty() ? NULL : &table[0], starts, NULL);
+            fprintf(stderr, "%-28s %14llu %14llu %7.1f%%  %s\n", program.path.c_str(),
+                    (unsigned long long) program.dispatches, (unsigned long long) program.fused,
+                    100.0 * (program.dispatches - program.fused) / program.dispatches,
+                    s == 0 ? "held out" : "trained");
+        }
+    }
+    write_table(stdout, programs, held_out, table);
+    return 0;
+}
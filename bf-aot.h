@@ -0,0 +1,246 @@
+#ifndef BF_AOT_H
+#define BF_AOT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xbyak/xbyak.h>
+
+#include "bf-codegen.h"
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-tape.h"
+
+// A static executable without libc: the I/O routines and the program as
+// Jit emits them standalone, and _start, which maps the tape, restores
+// the prefix evaluated at compile time and calls the program.
+//
+//   file / memory           contents
+//   headers                 ELF header, program headers
+//   rodata                  prefix output, prefix cells, error message
+//   code                    I/O routines, _start, program  (R-X)
+//   data (next page)        IO: pointers in the file, buffers in bss (RW-)
+//
+// The tape is one MAP_NORESERVE mapping of TAPE_RESERVE bytes with a
+// PROT_NONE page at each end, committed by the kernel as it is touched;
+// running off it is a plain SIGSEGV.
+#define AOT_PAGE 4096
+// bytes of the routines and _start
+#define AOT_RUNTIME_SIZE 1024
+#ifdef XBYAK64
+typedef Elf64_Ehdr Ehdr;
+typedef Elf64_Phdr Phdr;
+#define AOT_CLASS ELFCLASS64
+#define AOT_MACHINE EM_X86_64
+#define AOT_BASE 0x400000
+#else
+typedef Elf32_Ehdr Ehdr;
+typedef Elf32_Phdr Phdr;
+#define AOT_CLASS ELFCLASS32
+#define AOT_MACHINE EM_386
+#define AOT_BASE 0x8048000
+#endif
+
+size_t round_up(size_t n, size_t unit) {
+    return (n + unit - 1) / unit * unit;
+}
+#ifdef XBYAK64
+// maps the tape, leaves its origin in rbx
+void emit_tape(Xbyak::CodeGenerator &gen, size_t origin) {
+    gen.mov(gen.eax, 9);
+    gen.xor_(gen.edi, gen.edi);
+    gen.mov(gen.rsi, (size_t) TAPE_RESERVE);
+    gen.mov(gen.edx, PROT_NONE);
+    gen.mov(gen.r10d, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    gen.mov(gen.r8, -1);
+    gen.xor_(gen.r9d, gen.r9d);
+    gen.syscall();
+    gen.cmp(gen.rax, -AOT_PAGE);
+    gen.ja("aot_fail", Xbyak::CodeGenerator::T_NEAR);
+    gen.mov(gen.rbx, gen.rax);
+    gen.lea(gen.rdi, gen.ptr[gen.rbx + AOT_PAGE]);
+    gen.mov(gen.rsi, (size_t) TAPE_RESERVE - 2 * AOT_PAGE);
+    gen.mov(gen.edx, PROT_READ | PROT_WRITE);
+    gen.mov(gen.eax, 10);
+    gen.syscall();
+    gen.test(gen.rax, gen.rax);
+    gen.jnz("aot_fail", Xbyak::CodeGenerator::T_NEAR);
+    gen.mov(gen.rax, origin);
+    gen.add(gen.rbx, gen.rax);
+}
+void emit_copy(Xbyak::CodeGenerator &gen, int to, size_t from, size_t n) {
+    gen.lea(gen.rdi, gen.ptr[gen.rbx + to]);
+    gen.mov(gen.rsi, from);
+    gen.mov(gen.rcx, n);
+    gen.rep();
+    gen.movsb();
+}
+void emit_print(Xbyak::CodeGenerator &gen, int fd, size_t data, size_t n) {
+    gen.mov(gen.edi, fd);
+    gen.mov(gen.rsi, data);
+    gen.mov(gen.rdx, n);
+    gen.call("io_write");
+}
+void emit_call_main(Xbyak::CodeGenerator &gen, int head, size_t io) {
+    gen.lea(gen.rdi, gen.ptr[gen.rbx + head]);
+    gen.mov(gen.rsi, io);
+    gen.call("aot_main");
+}
+void emit_exit(Xbyak::CodeGenerator &gen, int status) {
+    gen.mov(gen.eax, 231);
+    gen.mov(gen.edi, status);
+    gen.syscall();
+}
+#else
+// maps the tape, leaves its origin in ebp
+void emit_tape(Xbyak::CodeGenerator &gen, size_t origin) {
+    gen.mov(gen.eax, 192);
+    gen.xor_(gen.ebx, gen.ebx);
+    gen.mov(gen.ecx, (size_t) TAPE_RESERVE);
+    gen.mov(gen.edx, PROT_NONE);
+    gen.mov(gen.esi, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    gen.mov(gen.edi, -1);
+    gen.xor_(gen.ebp, gen.ebp);
+    gen.int_(0x80);
+    gen.cmp(gen.eax, -AOT_PAGE);
+    gen.ja("aot_fail", Xbyak::CodeGenerator::T_NEAR);
+    gen.mov(gen.ebp, gen.eax);
+    gen.lea(gen.ebx, gen.ptr[gen.ebp + AOT_PAGE]);
+    gen.mov(gen.ecx, (size_t) TAPE_RESERVE - 2 * AOT_PAGE);
+    gen.mov(gen.edx, PROT_READ | PROT_WRITE);
+    gen.mov(gen.eax, 125);
+    gen.int_(0x80);
+    gen.test(gen.eax, gen.eax);
+    gen.jnz("aot_fail", Xbyak::CodeGenerator::T_NEAR);
+    gen.add(gen.ebp, origin);
+}
+void emit_copy(Xbyak::CodeGenerator &gen, int to, size_t from, size_t n) {
+    gen.lea(gen.edi, gen.ptr[gen.ebp + to]);
+    gen.mov(gen.esi, from);
+    gen.mov(gen.ecx, n);
+    gen.rep();
+    gen.movsb();
+}
+void emit_print(Xbyak::CodeGenerator &gen, int fd, size_t data, size_t n) {
+    gen.mov(gen.ebx, fd);
+    gen.mov(gen.ecx, data);
+    gen.mov(gen.edx, n);
+    gen.call("io_write");
+}
+void emit_call_main(Xbyak::CodeGenerator &gen, int head, size_t io) {
+    gen.push(io);
+    gen.lea(gen.eax, gen.ptr[gen.ebp + head]);
+    gen.push(gen.eax);
+    gen.call("aot_main");
+    gen.add(gen.esp, 8);
+}
+void emit_exit(Xbyak::CodeGenerator &gen, int status) {
+    gen.mov(gen.eax, 252);
+    gen.mov(gen.ebx, status);
+    gen.int_(0x80);
+}
+#endif
+// writes insns, resumed from snapshot, as an executable to path
+template <typename Cell>
+void write_executable(const char *path, std::vector<Instruction> &insns,
+        const Snapshot<Cell> &snapshot, FlushPolicy policy, bool grow_left) {
+    static const char message[] = "tape reservation failed\n";
+    std::string rodata = snapshot.output;
+    size_t cells_at = rodata.size();
+    if (!snapshot.cells.empty())
+        rodata.append((const char*) &snapshot.cells[0], snapshot.cells.size() * sizeof(Cell));
+    size_t message_at = rodata.size();
+    rodata.append(message, sizeof(message) - 1);
+
+    size_t headers = sizeof(Ehdr) + 3 * sizeof(Phdr);
+    size_t code_at = round_up(headers + rodata.size(), 16);
+    size_t capacity = code_size(insns, 0, insns.size() - 1) + AOT_RUNTIME_SIZE;
+    size_t data_at = round_up(code_at + capacity, AOT_PAGE);
+    size_t io_addr = AOT_BASE + data_at;
+    size_t origin = grow_left ? round_up(TAPE_RESERVE / 2, AOT_PAGE) : 2 * AOT_PAGE;
+
+    Xbyak::CodeGenerator gen(capacity);
+    emit_io_routines(gen);
+    size_t entry = AOT_BASE + code_at + gen.getSize();
+    emit_tape(gen, origin);
+    if (!snapshot.cells.empty())
+        emit_copy(gen, snapshot.low * (int) sizeof(Cell), AOT_BASE + headers + cells_at,
+                snapshot.cells.size() * sizeof(Cell));
+    if (!snapshot.output.empty())
+        emit_print(gen, STDOUT_FILENO, AOT_BASE + headers, snapshot.output.size());
+    emit_call_main(gen, snapshot.head * (int) sizeof(Cell), io_addr);
+    emit_exit(gen, 0);
+    gen.L("aot_fail");
+    emit_print(gen, STDERR_FILENO, AOT_BASE + headers + message_at, sizeof(message) - 1);
+    emit_exit(gen, 1);
+    gen.L("aot_main");
+    IO image;
+    io_init(&image, policy);
+    Jit<Cell> jit(gen, insns, &image);
+    jit.standalone();
+    jit.program(snapshot.pc, NULL);
+    size_t code_bytes = gen.getSize();
+
+    // the I/O buffers as they are in the executable
+    unsigned char *image_base = (unsigned char*) &image;
+    image.out_pos = (unsigned char*) io_addr + (image.out_pos - image_base);
+    image.out_end = (unsigned char*) io_addr + (image.out_end - image_base);
+    image.in_pos = image.in_end = (unsigned char*) io_addr + offsetof(IO, in_buf);
+
+    Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = AOT_CLASS;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = AOT_MACHINE;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = entry;
+    ehdr.e_phoff = sizeof(Ehdr);
+    ehdr.e_ehsize = sizeof(Ehdr);
+    ehdr.e_phentsize = sizeof(Phdr);
+    ehdr.e_phnum = 3;
+
+    Phdr phdrs[3];
+    memset(phdrs, 0, sizeof(phdrs));
+    phdrs[0].p_type = PT_LOAD;
+    phdrs[0].p_flags = PF_R | PF_X;
+    phdrs[0].p_offset = 0;
+    phdrs[0].p_vaddr = phdrs[0].p_paddr = AOT_BASE;
+    phdrs[0].p_filesz = phdrs[0].p_memsz = code_at + code_bytes;
+    phdrs[0].p_align = AOT_PAGE;
+    phdrs[1].p_type = PT_LOAD;
+    phdrs[1].p_flags = PF_R | PF_W;
+    phdrs[1].p_offset = data_at;
+    phdrs[1].p_vaddr = phdrs[1].p_paddr = io_addr;
+    phdrs[1].p_filesz = offsetof(IO, out_buf);
+    phdrs[1].p_memsz = sizeof(IO);
+    phdrs[1].p_align = AOT_PAGE;
+    phdrs[2].p_type = PT_GNU_STACK;
+    phdrs[2].p_flags = PF_R | PF_W;
+
+    std::string file(data_at + offsetof(IO, out_buf), '\0');
+    memcpy(&file[0], &ehdr, sizeof(ehdr));
+    memcpy(&file[sizeof(ehdr)], phdrs, sizeof(phdrs));
+    memcpy(&file[headers], rodata.data(), rodata.size());
+    memcpy(&file[code_at], gen.getCode(), code_bytes);
+    memcpy(&file[data_at], &image, offsetof(IO, out_buf));
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+        throw "cannot open output file";
+    bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+    if (fclose(out) != 0 || !written)
+        throw "cannot write output file";
+    chmod(path, 0755);
+}
+
+#endif
@@ -0,0 +1,266 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "bf-engine.h"
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-lex.h"
+#include "bf-tape.h"
+
+// Runs one program on many inputs: it is compiled once, and the inputs
+// are run on a pool of threads that share the Program, including the VM
+// bytecode. Every worker has its own tape, cleared between runs, and its
+// own IO; the output of each input is collected in memory and written to
+// stdout in the order of the inputs, as soon as everything before it is
+// written.
+// A tape fault is not recovered: the input that runs off the tape kills
+// the whole process after "tape overflow" / "tape underflow", and only
+// the outputs already written survive.
+//
+// Inputs are dealt out in contiguous slices, one per worker, which takes
+// them from the front of its slice; a worker whose slice is done steals
+// from the back of the next one that has any left.
+struct Options {
+    int cell_bits;
+    int threads;
+    bool stats;
+    std::vector<const char*> inputs;
+    EngineOptions engine;
+};
+// the inputs one worker has left
+struct Queue {
+    pthread_mutex_t lock;
+    std::deque<size_t> items;
+    Queue() {
+        pthread_mutex_init(&lock, NULL);
+    }
+    ~Queue() {
+        pthread_mutex_destroy(&lock);
+    }
+    bool pop_front(size_t &item) {
+        pthread_mutex_lock(&lock);
+        bool found = !items.empty();
+        if (found) {
+            item = items.front();
+            items.pop_front();
+        }
+        pthread_mutex_unlock(&lock);
+        return found;
+    }
+    bool pop_back(size_t &item) {
+        pthread_mutex_lock(&lock);
+        bool found = !items.empty();
+        if (found) {
+            item = items.back();
+            items.pop_back();
+        }
+        pthread_mutex_unlock(&lock);
+        return found;
+    }
+};
+template <typename Cell>
+class Batch {
+private:
+    const Program<Cell> &program;
+    const std::vector<const char*> &inputs;
+    std::vector<Queue> queues;
+    std::vector<std::string> outputs;
+    std::vector<char> done;
+    // inputs before next are written, done ones after it wait for it
+    pthread_mutex_t emit_lock;
+    size_t next;
+    struct Worker {
+        Batch *batch;
+        size_t id;
+        size_t runs, steals;
+    };
+    std::vector<Worker> workers;
+    // the whole file, or false and a message on stderr
+    static bool read_file(const char *path, std::string &text) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+            return false;
+        }
+        char buf[BUFSIZ];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) != 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                perror(path);
+                break;
+            }
+            text.append(buf, n);
+        }
+        close(fd);
+        return n == 0;
+    }
+    bool take(size_t id, size_t &item, size_t &steals) {
+        if (queues[id].pop_front(item))
+            return true;
+        // nothing is queued after the start, once every queue was seen
+        // empty the batch is done
+        for (size_t i = 1; i < queues.size(); ++i) {
+            if (queues[(id + i) % queues.size()].pop_back(item)) {
+                ++steals;
+                return true;
+            }
+        }
+        return false;
+    }
+    void finish(size_t item, std::string &output) {
+        pthread_mutex_lock(&emit_lock);
+        outputs[item].swap(output);
+        done[item] = 1;
+        while (next < done.size() && done[next]) {
+            const std::string &text = outputs[next];
+            if (fwrite(text.data(), 1, text.size(), stdout) != text.size())
+                perror("stdout");
+            std::string().swap(outputs[next]);
+            ++next;
+        }
+        pthread_mutex_unlock(&emit_lock);
+    }
+    void work(Worker &worker) {
+        Tape *tape = program.new_tape();
+        std::vector<IO> io(1);
+        std::string input, output;
+        size_t item;
+        while (take(worker.id, item, worker.steals)) {
+            input.clear();
+            output.clear();
+            if (read_file(inputs[item], input)) {
+                StringIO context = { &input, 0, &output };
+                io_init(&io[0], FLUSH_FULL);
+                io[0].reader = read_string;
+                io[0].writer = write_string;
+                io[0].context = &context;
+                program.run(&io[0], *tape);
+                tape->clear();
+                ++worker.runs;
+            }
+            finish(item, output);
+        }
+        delete tape;
+    }
+    static void *start(void *arg) {
+        Worker *worker = (Worker*) arg;
+        worker->batch->work(*worker);
+        return NULL;
+    }
+public:
+    Batch(const Program<Cell> &program, const std::vector<const char*> &inputs, size_t threads) :
+        program(program), inputs(inputs), queues(threads), outputs(inputs.size()),
+        done(inputs.size(), 0), next(0), workers(threads) {
+        pthread_mutex_init(&emit_lock, NULL);
+        for (size_t i = 0; i < inputs.size(); ++i)
+            queues[i * threads / inputs.size()].items.push_back(i);
+        for (size_t i = 0; i < threads; ++i) {
+            workers[i].batch = this;
+            workers[i].id = i;
+            workers[i].runs = workers[i].steals = 0;
+        }
+    }
+    ~Batch() {
+        pthread_mutex_destroy(&emit_lock);
+    }
+    void run() {
+        std::vector<pthread_t> threads(workers.size());
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        // generated code and the VM keep what they need on the heap
+        pthread_attr_setstacksize(&attr, 1 << 20);
+        for (size_t i = 1; i < workers.size(); ++i)
+            pthread_create(&threads[i], &attr, start, &workers[i]);
+        pthread_attr_destroy(&attr);
+        work(workers[0]);
+        for (size_t i = 1; i < workers.size(); ++i)
+            pthread_join(threads[i], NULL);
+        fflush(stdout);
+    }
+    void report(FILE *out) const {
+        for (size_t i = 0; i < workers.size(); ++i)
+            fprintf(out, "thread %zu: %zu runs, %zu stolen\n", i, workers[i].runs, workers[i].steals);
+    }
+};
+template <typename Cell>
+void run(FILE *input, Options &options) {
+    double compile_start = now();
+    Source source(input);
+    Program<Cell> program(source.begin, source.end, options.engine);
+    double compile_end = now();
+    if (options.engine.passes.timing)
+        program.passes().report(stderr);
+    size_t threads = options.threads;
+    if (threads > options.inputs.size())
+        threads = options.inputs.size();
+    if (threads == 0)
+        return;
+    Batch<Cell> batch(program, options.inputs, threads);
+    batch.run();
+    if (options.stats) {
+        fprintf(stderr, "compile: %.3f ms, run: %.3f ms, inputs: %zu, threads: %zu\n",
+                compile_end - compile_start, now() - compile_end, options.inputs.size(), threads);
+        batch.report(stderr);
+    }
+}
+int main(int argc, char *argv[]) {
+    if(argc == 1) {
+        printf("usage: $0 <file>(- for stdin) [-vm] [-threads=<n>] [-cell8|-cell16|-cell32] [-grow-left] [-huge-pages] [-stats] [-time-passes] [-no-<pass>] [-prefix-budget=<n>] <input>...\n");
+        return 0;
+    }
+    Options options;
+    options.cell_bits = 32;
+    options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    options.stats = false;
+    for (int i = 2; i < argc; ++i) {
+        const char *option = argv[i];
+        if (options.engine.passes.parse_option(option)) {
+            continue;
+        } else if (strcmp(option, "-vm") == 0) {
+            options.engine.backend = BACKEND_VM;
+        } else if (strncmp(option, "-threads=", 9) == 0) {
+            options.threads = atoi(option + 9);
+        } else if (strcmp(option, "-grow-left") == 0) {
+            options.engine.grow_left = true;
+        } else if (strcmp(option, "-huge-pages") == 0) {
+            options.engine.huge_pages = true;
+        } else if (strcmp(option, "-stats") == 0) {
+            options.stats = true;
+        } else if (strcmp(option, "-cell8") == 0) {
+            options.cell_bits = 8;
+        } else if (strcmp(option, "-cell16") == 0) {
+            options.cell_bits = 16;
+        } else if (strcmp(option, "-cell32") == 0) {
+            options.cell_bits = 32;
+        } else {
+            options.inputs.push_back(option);
+        }
+    }
+    if (options.threads < 1)
+        options.threads = 1;
+    FILE *input = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    switch (options.cell_bits) {
+        case 8:
+            run<uint8_t>(input, options);
+            break;
+        case 16:
+            run<uint16_t>(input, options);
+            break;
+        default:
+            run<uint32_t>(input, options);
+            break;
+    }
+    if (input != stdin)
+        fclose(input);
+    return 0;
+}
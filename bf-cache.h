@@ -0,0 +1,201 @@
+#ifndef BF_CACHE_H
+#define BF_CACHE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-lex.h"
+
+// Compiled programs by content. <dir>/<hash of the key>.bfc holds the key
+// it was made for (engine, CODE_VERSION, cell width, options, CPU
+// features and the source), the optimized instructions, the prefix
+// snapshot, and for the JIT the Jit::standalone() code, which is position
+// independent and is mapped executable straight from the file.
+// Files are written under a temporary name and renamed into place, so
+// readers and concurrent writers only ever see complete files. A file
+// whose version, key or checksum does not match is ignored and replaced.
+// CACHE_VERSION is the file layout.
+#define CACHE_VERSION 1
+#define CACHE_PAGE 4096
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    // FNV-1a of everything after the header
+    uint64_t checksum;
+    uint64_t key_size, insn_count, cell_count, output_size;
+    uint64_t pc;
+    int64_t head, low;
+    // code is page aligned in the file, entry is relative to it
+    uint64_t code_offset, code_size, entry;
+};
+uint64_t fnv1a(const void *data, size_t n, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char *p = (const unsigned char*) data;
+    for (size_t i = 0; i < n; ++i)
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    return hash;
+}
+// -cache=<dir>, or $XDG_CACHE_HOME/fast-bf, or ~/.cache/fast-bf
+std::string cache_dir(const char *dir) {
+    if (dir != NULL && *dir != '\0')
+        return dir;
+    if (const char *xdg = getenv("XDG_CACHE_HOME"))
+        return std::string(xdg) + "/fast-bf";
+    const char *home = getenv("HOME");
+    std::string cache = std::string(home != NULL ? home : ".") + "/.cache";
+    mkdir(cache.c_str(), 0755);
+    return cache + "/fast-bf";
+}
+// everything the cached result depends on
+std::string cache_key(const char *engine, int cell_bits, FlushPolicy policy,
+        const PassManager &passes, const Source &source) {
+    char head[256];
+    std::string enabled;
+    for (int i = 0; i < PASS_COUNT; ++i)
+        enabled += passes.enabled[i] ? '1' : '0';
+    __builtin_cpu_init();
+    snprintf(head, sizeof(head), "%s code%d cell%d ptr%d insn%d policy%d passes%s budget%ld sse2%d avx2%d\n",
+            engine, CODE_VERSION, cell_bits, (int) sizeof(void*) * 8, (int) sizeof(Instruction), (int) policy,
+            enabled.c_str(), passes.budget,
+            __builtin_cpu_supports("sse2") != 0, __builtin_cpu_supports("avx2") != 0);
+    return head + std::string(source.begin, source.end);
+}
+template <typename Cell>
+class CachedProgram {
+private:
+    void *code_map;
+    size_t code_map_size;
+public:
+    std::vector<Instruction> insns;
+    Snapshot<Cell> snapshot;
+    // void f(Cell *membuf, IO *io), NULL without code
+    void *code;
+    std::string path;
+    CachedProgram(const std::string &dir, const std::string &key) :
+        code_map(NULL), code_map_size(0), code(NULL) {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.bfc", (unsigned long long) fnv1a(key.data(), key.size()));
+        path = dir + name;
+    }
+    ~CachedProgram() {
+        if (code_map != NULL)
+            munmap(code_map, code_map_size);
+    }
+    // false when there is no usable file for key
+    bool load(const std::string &key) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(CacheHeader))
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        size_t size = st.st_size;
+        const char *file = (const char*) map;
+        CacheHeader header;
+        memcpy(&header, file, sizeof(header));
+        size_t data_size = header.insn_count * sizeof(Instruction) +
+            header.cell_count * sizeof(Cell) + header.output_size;
+        bool valid = memcmp(header.magic, "BFC", 4) == 0 && header.version == CACHE_VERSION &&
+            header.key_size == key.size() && header.insn_count <= size && header.cell_count <= size &&
+            header.output_size <= size && sizeof(header) + key.size() + data_size <= size &&
+            header.code_offset % CACHE_PAGE == 0 && header.code_offset <= size &&
+            header.code_size <= size - header.code_offset && header.entry <= header.code_size &&
+            header.checksum == fnv1a(file + sizeof(header), size - sizeof(header)) &&
+            memcmp(file + sizeof(header), key.data(), key.size()) == 0;
+        if (valid) {
+            const char *p = file + sizeof(header) + key.size();
+            insns.assign(header.insn_count, Instruction(END));
+            memcpy(&insns[0], p, header.insn_count * sizeof(Instruction));
+            p += header.insn_count * sizeof(Instruction);
+            snapshot.cells.assign((const Cell*) p, (const Cell*) p + header.cell_count);
+            p += header.cell_count * sizeof(Cell);
+            snapshot.output.assign(p, header.output_size);
+            snapshot.pc = header.pc;
+            snapshot.head = header.head;
+            snapshot.low = header.low;
+            if (header.code_size > 0) {
+                // without exec permission for the file the caller generates
+                // the code itself
+                void *code_at = mmap(NULL, header.code_size, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                        fd, header.code_offset);
+                if (code_at != MAP_FAILED) {
+                    code_map = code_at;
+                    code_map_size = header.code_size;
+                    code = (char*) code_at + header.entry;
+                }
+            }
+        }
+        munmap(map, size);
+        close(fd);
+        return valid;
+    }
+    // writes insns, snapshot and code (code_size bytes, entry at entry) for
+    // key; failures only mean the next run compiles again
+    void store(const std::string &key, const void *code, size_t code_size, size_t entry) const {
+        size_t slash = path.rfind('/');
+        mkdir(path.substr(0, slash).c_str(), 0755);
+
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "BFC", 4);
+        header.version = CACHE_VERSION;
+        header.key_size = key.size();
+        header.insn_count = insns.size();
+        header.cell_count = snapshot.cells.size();
+        header.output_size = snapshot.output.size();
+        header.pc = snapshot.pc;
+        header.head = snapshot.head;
+        header.low = snapshot.low;
+        std::string body = key;
+        body.append((const char*) &insns[0], insns.size() * sizeof(Instruction));
+        if (!snapshot.cells.empty())
+            body.append((const char*) &snapshot.cells[0], snapshot.cells.size() * sizeof(Cell));
+        body += snapshot.output;
+        if (code_size > 0) {
+            size_t offset = (sizeof(header) + body.size() + CACHE_PAGE - 1) / CACHE_PAGE * CACHE_PAGE;
+            body.resize(offset - sizeof(header));
+            body.append((const char*) code, code_size);
+            header.code_offset = offset;
+            header.code_size = code_size;
+            header.entry = entry;
+        }
+        header.checksum = fnv1a(body.data(), body.size());
+        std::string file((const char*) &header, sizeof(header));
+        file += body;
+
+        std::string temp = path.substr(0, slash) + "/.tmp.XXXXXX";
+        int fd = mkstemp(&temp[0]);
+        if (fd < 0)
+            return;
+        size_t written = 0;
+        while (written < file.size()) {
+            ssize_t n = write(fd, file.data() + written, file.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            written += n;
+        }
+        fchmod(fd, 0644);
+        if (close(fd) != 0 || written != file.size() || rename(temp.c_str(), path.c_str()) != 0)
+            unlink(temp.c_str());
+    }
+};
+
+#endif
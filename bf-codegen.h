@@ -0,0 +1,761 @@
+#ifndef BF_CODEGEN_H
+#define BF_CODEGEN_H
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <stack>
+#include <vector>
+#include <stdint.h>
+
+#include <xbyak/xbyak.h>
+
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-profile.h"
+#include "bf-scan.h"
+
+// upper bound of the bytes Jit emits for insns[from..to]; Jit::emit()
+// holds every instruction to its share
+size_t code_size(std::vector<Instruction> &insns, size_t from, size_t to,
+        bool profile = false) {
+    size_t size = 64;
+    for (size_t pc=from; pc <= to; ++pc) {
+        // counters of loop heads, cycles at the end of loops
+        if (profile && (insns[pc].line != 0 || insns[pc].op == CLOSE))
+            size += 160;
+        switch (insns[pc].op) {
+            case GET:
+            case PUT:
+                size += 64;
+                break;
+            case SET_MULTIPLIER:
+            case MEM_MOVE:
+                size += 48;
+                break;
+            case OPEN:
+                // region loads, the padding of an aligned loop head
+                size += 80;
+                break;
+            case CLOSE:
+                // region write-backs
+                size += 56;
+                break;
+            case SEARCH_ZERO:
+                size += 128;
+                break;
+            case CALC:
+            case LOAD:
+                size += 16;
+                break;
+            case MOVE:
+                size += 8;
+                break;
+            default:
+                size += 24;
+                break;
+        }
+    }
+    return size;
+}
+#ifdef XBYAK64
+typedef Xbyak::Reg64 PtrReg;
+#else
+typedef Xbyak::Reg32 PtrReg;
+#endif
+// call func(arg), the result is left in eax
+void call(Xbyak::CodeGenerator &gen, const void *func, const PtrReg &arg) {
+#ifdef XBYAK64
+    gen.mov(gen.rdi, arg);
+    // the callee may live further than rel32 away from the code buffer
+    gen.mov(gen.rax, (size_t) func);
+    gen.call(gen.rax);
+#else
+    gen.push(arg);
+    gen.call(func);
+    gen.pop(gen.ecx);
+#endif
+}
+// cell sized memory operand and register views
+template <typename Cell>
+Xbyak::Address cell_ptr(Xbyak::CodeGenerator &gen, const Xbyak::RegExp &exp) {
+    switch (sizeof(Cell)) {
+        case 1:
+            return gen.byte[exp];
+        case 2:
+            return gen.word[exp];
+        default:
+            return gen.dword[exp];
+    }
+}
+template <typename Cell>
+Xbyak::Reg cell_reg(const Xbyak::Reg32 &reg) {
+    switch (sizeof(Cell)) {
+        case 1:
+            return reg.cvt8();
+        case 2:
+            return reg.cvt16();
+        default:
+            return reg;
+    }
+}
+// a constant for a cell operand, sign-extended from the cell width: the
+// form Xbyak's range checks accept for every operand size in both add()
+// and mov(), where (Cell) -1 is too big for a word
+template <typename Cell>
+int cell_imm(int value) {
+    switch (sizeof(Cell)) {
+        case 1:
+            return (int8_t) value;
+        case 2:
+            return (int16_t) value;
+        default:
+            return value;
+    }
+}
+// zero-extending load of a cell
+template <typename Cell>
+void load(Xbyak::CodeGenerator &gen, const Xbyak::Reg32 &reg, const Xbyak::Operand &cell) {
+    if (sizeof(Cell) == 4)
+        gen.mov(reg, cell);
+    else
+        gen.movzx(reg, cell);
+}
+// A loop whose body never moves the pointer keeps its most used cells in
+// registers. They are loaded before the loop, written back after it, and
+// written back and reloaded around s(n), which reads the tape and moves
+// the pointer. The registers are callee-saved, so calls for , and . need
+// no spills.
+struct Region {
+    size_t open, close;
+    std::vector<int> offsets;
+};
+void find_regions(std::vector<Instruction> &insns, size_t from, size_t to,
+        size_t count, size_t start, std::vector<Region> &regions) {
+    if (count == 0)
+        return;
+    for (size_t pc=from; pc < to; ++pc) {
+        if (insns[pc].op != OPEN)
+            continue;
+        size_t close = pc + insns[pc].value.i1;
+        // the compiled prefix may not enter a region halfway, and the [ ]
+        // around a linear loop runs at most once
+        bool eligible = !(start > pc && start <= close) &&
+            !(insns[pc + 1].op == SET_MULTIPLIER && insns[pc + 1].offset == insns[pc].offset);
+        // uses of inner loops weigh more
+        std::map<int, int> uses;
+        int depth = 0;
+        for (size_t i = pc + 1; eligible && i < close; ++i) {
+            const Instruction &insn = insns[i];
+            int weight = 1 << (depth < 8 ? 2 * depth : 16);
+            switch (insn.op) {
+                case MOVE:
+                    eligible = false;
+                    break;
+                case OPEN:
+                    uses[insn.offset] += weight;
+                    ++depth;
+                    break;
+                case CLOSE:
+                    --depth;
+                    break;
+                case MEM_MOVE:
+                    uses[insn.offset] += weight;
+                    uses[insn.offset + insn.value.s2.s0] += weight;
+                    break;
+                case SEARCH_ZERO:
+                    break;
+                default:
+                    uses[insn.offset] += weight;
+                    break;
+            }
+        }
+        if (!eligible)
+            continue;
+        // the loop condition runs once more than the body
+        uses[insns[pc].offset] += 2;
+        Region region;
+        region.open = pc;
+        region.close = close;
+        while (region.offsets.size() < count) {
+            std::map<int, int>::iterator best = uses.end();
+            for (std::map<int, int>::iterator it = uses.begin(); it != uses.end(); ++it) {
+                if (best == uses.end() || it->second > best->second)
+                    best = it;
+            }
+            if (best == uses.end() || best->second < 2)
+                break;
+            region.offsets.push_back(best->first);
+            uses.erase(best);
+        }
+        if (!region.offsets.empty()) {
+            regions.push_back(region);
+            pc = close;
+        }
+    }
+}
+// whether the loop at insns[open] gets an aligned head: it has no loops
+// of its own, so its body runs more often than the ones around it, and
+// it is not the [ ] around a linear loop, which runs at most once
+bool hot_loop(const std::vector<Instruction> &insns, size_t open) {
+    size_t close = open + insns[open].value.i1;
+    if (insns[open + 1].op == SET_MULTIPLIER && insns[open + 1].offset == insns[open].offset)
+        return false;
+    for (size_t pc = open + 1; pc < close; ++pc) {
+        if (insns[pc].op == OPEN)
+            return false;
+    }
+    return true;
+}
+// the I/O routines Jit::standalone() code calls, made of system calls so
+// that the code depends on nothing of the process it runs in
+#define IO_ROUTINES_SIZE 512
+void emit_io_routines(Xbyak::CodeGenerator &gen) {
+#ifdef XBYAK64
+    // write(edi, rsi, rdx) until all is written or it fails
+    gen.L("io_write");
+    gen.test(gen.rdx, gen.rdx);
+    gen.jz("io_write_done");
+    gen.mov(gen.eax, 1);
+    gen.syscall();
+    gen.cmp(gen.rax, -EINTR);
+    gen.je("io_write");
+    gen.test(gen.rax, gen.rax);
+    gen.jle("io_write_done");
+    gen.add(gen.rsi, gen.rax);
+    gen.sub(gen.rdx, gen.rax);
+    gen.jmp("io_write");
+    gen.L("io_write_done");
+    gen.ret();
+    // io_flush(rdi), keeps r9
+    gen.L("io_flush");
+    gen.mov(gen.r8, gen.rdi);
+    gen.lea(gen.rsi, gen.ptr[gen.r8 + offsetof(IO, out_buf)]);
+    gen.mov(gen.rdx, gen.ptr[gen.r8 + offsetof(IO, out_pos)]);
+    gen.sub(gen.rdx, gen.rsi);
+    gen.mov(gen.edi, gen.dword[gen.r8 + offsetof(IO, out_fd)]);
+    gen.call("io_write");
+    gen.lea(gen.rax, gen.ptr[gen.r8 + offsetof(IO, out_buf)]);
+    gen.mov(gen.ptr[gen.r8 + offsetof(IO, out_pos)], gen.rax);
+    gen.ret();
+    // io_get(rdi)
+    gen.L("io_get");
+    gen.mov(gen.r9, gen.rdi);
+    gen.call("io_flush");
+    gen.mov(gen.rsi, gen.ptr[gen.r9 + offsetof(IO, in_pos)]);
+    gen.cmp(gen.rsi, gen.ptr[gen.r9 + offsetof(IO, in_end)]);
+    gen.jb("io_get_next");
+    gen.L("io_get_read");
+    gen.xor_(gen.eax, gen.eax);
+    gen.mov(gen.edi, gen.dword[gen.r9 + offsetof(IO, in_fd)]);
+    gen.lea(gen.rsi, gen.ptr[gen.r9 + offsetof(IO, in_buf)]);
+    gen.mov(gen.edx, IOBUFSIZE);
+    gen.syscall();
+    gen.cmp(gen.rax, -EINTR);
+    gen.je("io_get_read");
+    gen.test(gen.rax, gen.rax);
+    gen.jle("io_get_eof");
+    gen.lea(gen.rsi, gen.ptr[gen.r9 + offsetof(IO, in_buf)]);
+    gen.lea(gen.rdx, gen.ptr[gen.rsi + gen.rax]);
+    gen.mov(gen.ptr[gen.r9 + offsetof(IO, in_end)], gen.rdx);
+    gen.L("io_get_next");
+    gen.movzx(gen.eax, gen.byte[gen.rsi]);
+    gen.add(gen.rsi, 1);
+    gen.mov(gen.ptr[gen.r9 + offsetof(IO, in_pos)], gen.rsi);
+    gen.ret();
+    gen.L("io_get_eof");
+    gen.mov(gen.eax, -1);
+    gen.ret();
+#else
+    // write(ebx, ecx, edx) until all is written or it fails
+    gen.L("io_write");
+    gen.test(gen.edx, gen.edx);
+    gen.jz("io_write_done");
+    gen.mov(gen.eax, 4);
+    gen.int_(0x80);
+    gen.cmp(gen.eax, -EINTR);
+    gen.je("io_write");
+    gen.test(gen.eax, gen.eax);
+    gen.jle("io_write_done");
+    gen.add(gen.ecx, gen.eax);
+    gen.sub(gen.edx, gen.eax);
+    gen.jmp("io_write");
+    gen.L("io_write_done");
+    gen.ret();
+    // io_flush(io), cdecl
+    gen.L("io_flush");
+    gen.push(gen.ebx);
+    gen.push(gen.esi);
+    gen.mov(gen.esi, gen.ptr[gen.esp + 12]);
+    gen.mov(gen.ebx, gen.dword[gen.esi + offsetof(IO, out_fd)]);
+    gen.lea(gen.ecx, gen.ptr[gen.esi + offsetof(IO, out_buf)]);
+    gen.mov(gen.edx, gen.ptr[gen.esi + offsetof(IO, out_pos)]);
+    gen.sub(gen.edx, gen.ecx);
+    gen.call("io_write");
+    gen.lea(gen.eax, gen.ptr[gen.esi + offsetof(IO, out_buf)]);
+    gen.mov(gen.ptr[gen.esi + offsetof(IO, out_pos)], gen.eax);
+    gen.pop(gen.esi);
+    gen.pop(gen.ebx);
+    gen.ret();
+    // io_get(io), cdecl
+    gen.L("io_get");
+    gen.push(gen.ebx);
+    gen.push(gen.esi);
+    gen.mov(gen.esi, gen.ptr[gen.esp + 12]);
+    gen.push(gen.esi);
+    gen.call("io_flush");
+    gen.add(gen.esp, 4);
+    gen.mov(gen.ecx, gen.ptr[gen.esi + offsetof(IO, in_pos)]);
+    gen.cmp(gen.ecx, gen.ptr[gen.esi + offsetof(IO, in_end)]);
+    gen.jb("io_get_next");
+    gen.L("io_get_read");
+    gen.mov(gen.eax, 3);
+    gen.mov(gen.ebx, gen.dword[gen.esi + offsetof(IO, in_fd)]);
+    gen.lea(gen.ecx, gen.ptr[gen.esi + offsetof(IO, in_buf)]);
+    gen.mov(gen.edx, IOBUFSIZE);
+    gen.int_(0x80);
+    gen.cmp(gen.eax, -EINTR);
+    gen.je("io_get_read");
+    gen.test(gen.eax, gen.eax);
+    gen.jle("io_get_eof");
+    gen.lea(gen.ecx, gen.ptr[gen.esi + offsetof(IO, in_buf)]);
+    gen.lea(gen.edx, gen.ptr[gen.ecx + gen.eax]);
+    gen.mov(gen.ptr[gen.esi + offsetof(IO, in_end)], gen.edx);
+    gen.L("io_get_next");
+    gen.movzx(gen.eax, gen.byte[gen.ecx]);
+    gen.add(gen.ecx, 1);
+    gen.mov(gen.ptr[gen.esi + offsetof(IO, in_pos)], gen.ecx);
+    gen.pop(gen.esi);
+    gen.pop(gen.ebx);
+    gen.ret();
+    gen.L("io_get_eof");
+    gen.mov(gen.eax, -1);
+    gen.pop(gen.esi);
+    gen.pop(gen.ebx);
+    gen.ret();
+#endif
+}
+// Emits insns as native code: the whole program, or a single loop as a
+// function for the tiered engine.
+template <typename Cell>
+class Jit {
+private:
+    Xbyak::CodeGenerator &gen;
+    std::vector<Instruction> &insns;
+    IO *io;
+    FlushPolicy policy;
+    // , and . call the routines emit_io_routines() put before the code
+    // instead of io_get() and io_flush(), s(n) does not call the scan
+    // kernels of this process
+    bool builtin_io;
+    // the tape and IO are arguments of program() instead of immediates
+    bool arguments;
+    LoopProfile *profile;
+    PtrReg memreg, ioreg, posreg;
+    Xbyak::Reg32 multreg, tmpreg;
+    std::vector<PtrReg> saved;
+    std::vector<Xbyak::Reg32> cellregs;
+    int labelNum, searchNum, putNum;
+    // the . whose flush is emitted out of line, by emit_cold()
+    std::vector<int> flushes;
+    // per instance, so that several threads can compile at once
+    char labelbuf[32];
+    const char *toLabel(char ch, int num) {
+        snprintf(labelbuf, sizeof(labelbuf), "%c%d", ch, num);
+        return labelbuf;
+    }
+    void prologue() {
+        for (size_t i = 0; i < saved.size(); ++i)
+            gen.push(saved[i]);
+#ifdef XBYAK64
+        gen.sub(gen.rsp, 8);
+#endif
+    }
+    void epilogue() {
+#ifdef XBYAK64
+        gen.add(gen.rsp, 8);
+#endif
+        for (size_t i = saved.size(); i > 0; --i)
+            gen.pop(saved[i - 1]);
+        gen.ret();
+    }
+    // reg = argument n, after prologue()
+    void argument(const PtrReg &reg, int n) {
+#ifdef XBYAK64
+        gen.mov(reg, n == 0 ? gen.rdi : gen.rsi);
+#else
+        gen.mov(reg, gen.ptr[gen.esp + (int) (saved.size() + 1 + n) * 4]);
+#endif
+    }
+    void call_io(const void *func, const char *routine) {
+        if (!builtin_io) {
+            call(gen, func, ioreg);
+            return;
+        }
+#ifdef XBYAK64
+        gen.mov(gen.rdi, ioreg);
+        gen.call(routine);
+#else
+        gen.push(ioreg);
+        gen.call(routine);
+        gen.pop(gen.ecx);
+#endif
+    }
+    // counters of the loop headed by insns[pc] when profiling
+    LoopProfile *profiled(size_t pc) {
+        return profile != NULL && insns[pc].line != 0 ? &profile[pc] : NULL;
+    }
+    // the profile code uses eax, ecx and edx, which hold nothing across
+    // loop heads; edx is multreg on x86 but only live inside a multiplier
+#ifdef XBYAK64
+    void increment(uint64_t *counter) {
+        gen.mov(gen.rcx, (size_t) counter);
+        gen.add(gen.qword[gen.rcx], 1);
+    }
+    // counter += rax
+    void count(uint64_t *counter) {
+        gen.mov(gen.rcx, (size_t) counter);
+        gen.add(gen.qword[gen.rcx], gen.rax);
+    }
+    void stamp(uint64_t *start) {
+        gen.rdtsc();
+        gen.shl(gen.rdx, 32);
+        gen.or_(gen.rax, gen.rdx);
+        gen.mov(gen.rcx, (size_t) start);
+        gen.mov(gen.qword[gen.rcx], gen.rax);
+    }
+    void elapsed(uint64_t *start, uint64_t *total) {
+        gen.rdtsc();
+        gen.shl(gen.rdx, 32);
+        gen.or_(gen.rax, gen.rdx);
+        gen.mov(gen.rcx, (size_t) start);
+        gen.sub(gen.rax, gen.qword[gen.rcx]);
+        count(total);
+    }
+#else
+    void increment(uint64_t *counter) {
+        gen.add(gen.dword[(size_t) counter], 1);
+        gen.adc(gen.dword[(size_t) counter + 4], 0);
+    }
+    // counter += eax
+    void count(uint64_t *counter) {
+        gen.add(gen.dword[(size_t) counter], gen.eax);
+        gen.adc(gen.dword[(size_t) counter + 4], 0);
+    }
+    void stamp(uint64_t *start) {
+        gen.rdtsc();
+        gen.mov(gen.dword[(size_t) start], gen.eax);
+        gen.mov(gen.dword[(size_t) start + 4], gen.edx);
+    }
+    void elapsed(uint64_t *start, uint64_t *total) {
+        gen.rdtsc();
+        gen.sub(gen.eax, gen.dword[(size_t) start]);
+        gen.sbb(gen.edx, gen.dword[(size_t) start + 4]);
+        gen.add(gen.dword[(size_t) total], gen.eax);
+        gen.adc(gen.dword[(size_t) total + 4], gen.edx);
+    }
+#endif
+    // sets the flags by the cell at offset, in its register or in memory
+    void test_cell(int offset, const std::map<int, size_t> &cells, const std::vector<Xbyak::Reg> &views) {
+        std::map<int, size_t>::const_iterator found = cells.find(offset);
+        if (found != cells.end())
+            gen.test(views[found->second], views[found->second]);
+        else
+            gen.cmp(cell_ptr<Cell>(gen, memreg + offset * (int) sizeof(Cell)), 0);
+    }
+    // the flushes of full output buffers, after the code that jumps to
+    // them so that the path of . that does not flush stays straight
+    void emit_cold() {
+        for (size_t i = 0; i < flushes.size(); ++i) {
+            gen.L(toLabel('F', flushes[i]));
+            call_io((void*) io_flush, "io_flush");
+            gen.jmp(toLabel('P', flushes[i]), Xbyak::CodeGenerator::T_NEAR);
+        }
+        flushes.clear();
+    }
+    // insns[from..to], entered at insns[start] through label Z unless
+    // start is 0. Loops test their cell once before the body and again at
+    // its end, so an iteration takes one branch; the heads of hot_loop()s
+    // are aligned, and jumps that are known to be in range are short.
+    void emit(size_t from, size_t to, size_t start) {
+        Xbyak::Address out_pos = gen.ptr[ioreg + offsetof(IO, out_pos)];
+        Xbyak::Address out_end = gen.ptr[ioreg + offsetof(IO, out_end)];
+
+        std::vector<Region> regions;
+        find_regions(insns, from, to, cellregs.size(), start, regions);
+        size_t region = 0;
+        // offset -> index into cellregs, while inside a region
+        std::map<int, size_t> cells;
+        std::vector<Xbyak::Reg> views;
+        for (size_t i = 0; i < cellregs.size(); ++i)
+            views.push_back(cell_reg<Cell>(cellregs[i]));
+
+        std::stack<int> labelStack;
+        int beginNum;
+        for (size_t pc=from; pc <= to; ++pc) {
+            Instruction insn = insns[pc];
+            size_t before = gen.getSize();
+            if (start != 0 && pc == start)
+                gen.L("Z");
+            bool enter = region < regions.size() && regions[region].open == pc;
+            if (enter) {
+                const std::vector<int> &offsets = regions[region].offsets;
+                for (size_t i = 0; i < offsets.size(); ++i) {
+                    load<Cell>(gen, cellregs[i], cell_ptr<Cell>(gen, memreg + offsets[i] * (int) sizeof(Cell)));
+                    cells[offsets[i]] = i;
+                }
+            }
+            Xbyak::Address mem = cell_ptr<Cell>(gen, memreg + insn.offset * (int) sizeof(Cell));
+            std::map<int, size_t>::iterator found = cells.find(insn.offset);
+            bool in_reg = found != cells.end();
+            const Xbyak::Operand &cell = in_reg ? (const Xbyak::Operand&) views[found->second] : mem;
+            switch (insn.op) {
+                case GET:
+                    call_io((void*) io_get, "io_get");
+                    gen.mov(cell, cell_reg<Cell>(gen.eax));
+                    break;
+                case PUT:
+                    // *out_pos++ = *mem inline, io_flush() only when needed
+                    gen.mov(posreg, out_pos);
+                    load<Cell>(gen, gen.ecx, cell);
+                    gen.mov(gen.byte[posreg], gen.cl);
+                    gen.add(posreg, 1);
+                    gen.mov(out_pos, posreg);
+                    gen.cmp(posreg, out_end);
+                    gen.je(toLabel('F', putNum), Xbyak::CodeGenerator::T_NEAR);
+                    if (policy == FLUSH_LINE) {
+                        gen.cmp(gen.cl, '\n');
+                        gen.je(toLabel('F', putNum), Xbyak::CodeGenerator::T_NEAR);
+                    }
+                    gen.L(toLabel('P', putNum));
+                    flushes.push_back(putNum);
+                    ++putNum;
+                    break;
+                case OPEN: {
+                    if (LoopProfile *loop = profiled(pc)) {
+                        increment(&loop->entries);
+                        stamp(&loop->start);
+                    }
+                    // the padding, the body and the test at the CLOSE;
+                    // profiled loops count their iterations there too
+                    size_t body = code_size(insns, pc + 1, pc + insn.value.i1) - 64 + 15;
+                    bool fits = profile == NULL && body < 128;
+                    test_cell(insn.offset, cells, views);
+                    gen.jz(toLabel('R', labelNum),
+                            fits ? Xbyak::CodeGenerator::T_SHORT : Xbyak::CodeGenerator::T_NEAR);
+                    if (hot_loop(insns, pc))
+                        gen.align(16);
+                    gen.L(toLabel('L', labelNum));
+                    if (LoopProfile *loop = profiled(pc))
+                        increment(&loop->iterations);
+
+                    labelStack.push(labelNum);
+                    ++labelNum;
+                    break;
+                }
+                case CLOSE:
+                    beginNum = labelStack.top();
+                    labelStack.pop();
+
+                    // short when the loop is, the label is known
+                    test_cell(insns[pc - insn.value.i1 + 1].offset, cells, views);
+                    gen.jnz(toLabel('L', beginNum));
+                    gen.L(toLabel('R', beginNum));
+                    if (LoopProfile *loop = profiled(pc - insn.value.i1 + 1))
+                        elapsed(&loop->start, &loop->cycles);
+                    break;
+                case CALC:
+                    if ((Cell) insn.value.i1 != 0)
+                        gen.add(cell, cell_imm<Cell>(insn.value.i1));
+                    break;
+                case MOVE:
+                    if (insn.value.i1 != 0)
+                        gen.add(memreg, insn.value.i1 * (int) sizeof(Cell));
+                    break;
+                case SET_MULTIPLIER:
+                    load<Cell>(gen, multreg, cell);
+                    gen.mov(cell, 0);
+                    if (insn.value.i1 != 1)
+                        gen.imul(multreg, multreg, insn.value.i1);
+                    if (LoopProfile *loop = profiled(pc)) {
+                        increment(&loop->entries);
+                        load<Cell>(gen, gen.eax, cell_reg<Cell>(multreg));
+                        count(&loop->iterations);
+                    }
+                    break;
+                case CALC_MULT:
+                    gen.imul(tmpreg, multreg, insn.value.i1);
+                    gen.add(cell, cell_reg<Cell>(tmpreg));
+                    break;
+                case MEM_MOVE: {
+                    int offset = insn.offset + insn.value.s2.s0;
+                    Xbyak::Address target_mem = cell_ptr<Cell>(gen, memreg + offset * (int) sizeof(Cell));
+                    std::map<int, size_t>::iterator target_found = cells.find(offset);
+                    const Xbyak::Operand &target = target_found != cells.end() ?
+                        (const Xbyak::Operand&) views[target_found->second] : target_mem;
+                    load<Cell>(gen, multreg, cell);
+                    gen.mov(cell, 0);
+                    if (LoopProfile *loop = profiled(pc)) {
+                        increment(&loop->entries);
+                        gen.mov(gen.eax, multreg);
+                        count(&loop->iterations);
+                    }
+                    if (insn.value.s2.s1 != 1) {
+                        gen.imul(multreg, multreg, insn.value.s2.s1);
+                    }
+                    gen.add(target, cell_reg<Cell>(multreg));
+                    break;
+                }
+                case SEARCH_ZERO:
+                    for (std::map<int, size_t>::iterator it = cells.begin(); it != cells.end(); ++it)
+                        gen.mov(cell_ptr<Cell>(gen, memreg + it->first * (int) sizeof(Cell)), views[it->second]);
+                    if (LoopProfile *loop = profiled(pc)) {
+                        increment(&loop->entries);
+                        stamp(&loop->start);
+    #ifdef XBYAK64
+                        gen.mov(gen.rcx, (size_t) &loop->from);
+                        gen.mov(gen.qword[gen.rcx], memreg);
+    #else
+                        gen.mov(gen.dword[(size_t) &loop->from], memreg);
+    #endif
+                    }
+                    if (ScanFunc scan = builtin_io ? NULL : select_scan<Cell>(insn.value.i1)) {
+    #ifdef XBYAK64
+                        gen.mov(gen.rdi, memreg);
+                        gen.mov(gen.esi, insn.value.i1);
+                        gen.mov(gen.rax, (size_t) scan);
+                        gen.call(gen.rax);
+    #else
+                        gen.mov(gen.eax, insn.value.i1);
+                        gen.push(gen.eax);
+                        gen.push(memreg);
+                        gen.call((void*) scan);
+                        gen.add(gen.esp, 8);
+    #endif
+                        gen.mov(memreg, posreg);
+                    } else {
+                        gen.cmp(mem, 0);
+                        gen.jz(toLabel('E', searchNum));
+                        gen.L(toLabel('S', searchNum));
+                        gen.add(memreg, insn.value.i1 * (int) sizeof(Cell));
+                        gen.cmp(mem, 0);
+                        gen.jnz(toLabel('S', searchNum));
+                        gen.L(toLabel('E', searchNum));
+                        ++searchNum;
+                    }
+                    if (LoopProfile *loop = profiled(pc)) {
+                        // iterations = (memreg - from) / stride
+                        elapsed(&loop->start, &loop->cycles);
+    #ifdef XBYAK64
+                        gen.mov(gen.rax, memreg);
+                        gen.mov(gen.rcx, (size_t) &loop->from);
+                        gen.sub(gen.rax, gen.qword[gen.rcx]);
+                        gen.cqo();
+                        gen.mov(gen.rcx, insn.value.i1 * (int) sizeof(Cell));
+                        gen.idiv(gen.rcx);
+    #else
+                        gen.mov(gen.eax, memreg);
+                        gen.sub(gen.eax, gen.dword[(size_t) &loop->from]);
+                        gen.cdq();
+                        gen.mov(gen.ecx, insn.value.i1 * (int) sizeof(Cell));
+                        gen.idiv(gen.ecx);
+    #endif
+                        count(&loop->iterations);
+                    }
+                    for (std::map<int, size_t>::iterator it = cells.begin(); it != cells.end(); ++it)
+                        load<Cell>(gen, cellregs[it->second], cell_ptr<Cell>(gen, memreg + it->first * (int) sizeof(Cell)));
+                    break;
+                case LOAD:
+                    gen.mov(cell, cell_imm<Cell>(insn.value.i1));
+                    break;
+                case END:
+                    call_io((void*) io_flush, "io_flush");
+                    break;
+                default:
+                    throw "jit compile error";
+            }
+            if (!cells.empty() && regions[region].close == pc) {
+                for (std::map<int, size_t>::iterator it = cells.begin(); it != cells.end(); ++it)
+                    gen.mov(cell_ptr<Cell>(gen, memreg + it->first * (int) sizeof(Cell)), views[it->second]);
+                cells.clear();
+                ++region;
+            }
+            // the code buffer and the short guards rely on code_size()
+            if (gen.getSize() - before > code_size(insns, pc, pc, profile != NULL) - 64)
+                throw "jit code exceeds code_size()";
+        }
+    }
+public:
+#ifdef XBYAK64
+    // SysV ABI: r12/r13 are callee-saved so the tape pointer and the I/O
+    // buffers survive calls, r8/r9 are scratch and only live between calls,
+    // rbx/rbp/r14/r15 hold cells.
+    // rsp is kept 16-byte aligned at every call site.
+    Jit(Xbyak::CodeGenerator &gen, std::vector<Instruction> &insns, IO *io,
+            LoopProfile *profile = NULL) :
+        gen(gen), insns(insns), io(io), policy(io->policy),
+        builtin_io(false), arguments(false), profile(profile),
+        memreg(gen.r12), ioreg(gen.r13), posreg(gen.rax),
+        multreg(gen.r8d), tmpreg(gen.r9d),
+        labelNum(0), searchNum(0), putNum(0) {
+        const PtrReg regs[] = { gen.r12, gen.r13, gen.rbx, gen.rbp, gen.r14, gen.r15 };
+        saved.assign(regs, regs + 6);
+        cellregs.push_back(gen.ebx);
+        cellregs.push_back(gen.ebp);
+        cellregs.push_back(gen.r14d);
+        cellregs.push_back(gen.r15d);
+    }
+#else
+    // no register is left for cells
+    Jit(Xbyak::CodeGenerator &gen, std::vector<Instruction> &insns, IO *io,
+            LoopProfile *profile = NULL) :
+        gen(gen), insns(insns), io(io), policy(io->policy),
+        builtin_io(false), arguments(false), profile(profile),
+        memreg(gen.ebx), ioreg(gen.esi), posreg(gen.eax),
+        multreg(gen.edx), tmpreg(gen.eax),
+        labelNum(0), searchNum(0), putNum(0) {
+        saved.push_back(gen.ebx);
+        saved.push_back(gen.esi);
+    }
+#endif
+    // position independent code for executables and the cache: the I/O
+    // routines come from emit_io_routines(), and program() emits
+    // void f(Cell *membuf, IO *io)
+    void standalone() {
+        builtin_io = arguments = true;
+    }
+    // code that any number of runs can share: program() emits
+    // void f(Cell *membuf, IO *io), which calls io_get() and io_flush()
+    void reentrant() {
+        arguments = true;
+    }
+    // void f() running the program from insns[start] on membuf
+    void program(size_t start, Cell *membuf) {
+        prologue();
+        if (arguments) {
+            argument(memreg, 0);
+            argument(ioreg, 1);
+        } else {
+            gen.mov(memreg, (size_t) membuf);
+            gen.mov(ioreg, (size_t) io);
+        }
+        // resume where the prefix evaluated at compile time stopped
+        if (start != 0)
+            gen.jmp("Z", Xbyak::CodeGenerator::T_NEAR);
+        emit(0, insns.size() - 1, start);
+        epilogue();
+        emit_cold();
+    }
+    // NativeLoop f(mem) running the loop at insns[open]
+    void loop(size_t open) {
+        prologue();
+        argument(memreg, 0);
+        gen.mov(ioreg, (size_t) io);
+        emit(open, open + insns[open].value.i1, 0);
+        gen.mov(posreg, memreg);
+        epilogue();
+        emit_cold();
+    }
+};
+
+#endif
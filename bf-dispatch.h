@@ -0,0 +1,780 @@
+#ifndef BF_DISPATCH_H
+#define BF_DISPATCH_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-scan.h"
+#include "bf-super-table.h"
+#include "bf-vm.h"
+
+// Other ways for the VM to get from one instruction to the next, over the
+// same Bytecode as execute():
+//
+//   direct  execute(): word 0 of a record is the offset of its handler
+//   switch  a loop around a switch on the Handler in word 0
+//   token   word 0 stays the Handler, every handler ends with its own
+//           indirect jump through a table of them
+//   call    a call of a handler function per instruction in generated
+//           code, which runs loops with branches of its own
+//   cached  direct, with the cell under the pointer kept in a register
+//
+// execute() alone counts and profiles loops; direct and token run
+// superinstructions.
+enum Dispatch {
+    DISPATCH_DIRECT, DISPATCH_SWITCH, DISPATCH_TOKEN, DISPATCH_CALL, DISPATCH_CACHED,
+    DISPATCHES
+};
+const char *DISPATCH_NAMES[] = {
+    "direct", "switch", "token", "call", "cached",
+};
+bool parse_dispatch(const char *name, Dispatch &dispatch) {
+    for (int i = 0; i < DISPATCHES; ++i) {
+        if (strcmp(name, DISPATCH_NAMES[i]) == 0) {
+            dispatch = (Dispatch) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Cell>
+void execute_switch(const std::vector<Instruction> &insns, size_t start, Cell *membuf, IO *io) {
+    Bytecode<Cell> bytecode(insns, false, NULL);
+    ScanFunc scan = bytecode.scan;
+    Cell *mem = membuf;
+    Cell mult = 0;
+    Word *pc = bytecode.code + bytecode.at[start];
+#undef NEXT_LABEL
+#define NEXT_LABEL continue
+    for (;;) {
+        switch ((Handler) *pc) {
+            case H_GET:
+                SUPER_GET
+                break;
+            case H_PUT:
+                SUPER_PUT
+                break;
+            case H_OPEN:
+                SUPER_OPEN
+                break;
+            case H_CLOSE:
+                SUPER_CLOSE
+            case H_CALC:
+                SUPER_CALC
+                break;
+            case H_CALC_WIDE:
+                mem[pc[1]] += pc[2];
+                pc += 3;
+                break;
+            case H_MOVE:
+                SUPER_MOVE
+                break;
+            case H_LOAD:
+                SUPER_LOAD
+                break;
+            case H_LOAD_WIDE:
+                mem[pc[1]] = pc[2];
+                pc += 3;
+                break;
+            case H_MEM_MOVE:
+                SUPER_MEM_MOVE
+                break;
+            case H_SEARCH_ZERO:
+                while (*mem != 0)
+                    mem += pc[1];
+                pc += 3;
+                break;
+            case H_SCAN:
+                mem = (Cell*) scan(mem, pc[1]);
+                pc += 3;
+                break;
+            case H_SET_MULTIPLIER:
+                SUPER_SET_MULTIPLIER
+                break;
+            case H_SET_MULTIPLIER_WIDE:
+                mult = mem[pc[1]] * (Cell) pc[2];
+                mem[pc[1]] = 0;
+                pc += 3;
+                break;
+            case H_CALC_MULT:
+                SUPER_CALC_MULT
+                break;
+            case H_CALC_MULT_WIDE:
+                mem[pc[1]] += mult * (Cell) pc[2];
+                pc += 3;
+                break;
+            default:
+                io_flush(io);
+                return;
+        }
+    }
+#undef NEXT_LABEL
+}
+
+// superinstructions are the tokens from PLAIN_HANDLERS on
+template <typename Cell>
+void execute_token(const std::vector<Instruction> &insns, size_t start, Cell *membuf, IO *io,
+        bool super = true) {
+    Bytecode<Cell> bytecode(insns, false, NULL);
+    Word *code = bytecode.code;
+    ScanFunc scan = bytecode.scan;
+    if (super) {
+        std::vector<int> starts;
+        packed_supers<Cell>(insns, starts);
+        for (size_t pc = 0; pc < insns.size(); ++pc) {
+            if (starts[pc] != 0)
+                code[bytecode.at[pc]] = PLAIN_HANDLERS + starts[pc] - 1;
+        }
+    }
+    // in the order of Handler
+    static void *const handlers[] = {
+        &&LABEL_GET, &&LABEL_PUT, &&LABEL_OPEN, &&LABEL_CLOSE, &&LABEL_CALC, &&LABEL_CALC_WIDE,
+        &&LABEL_MOVE, &&LABEL_LOAD, &&LABEL_LOAD_WIDE, &&LABEL_MEM_MOVE, &&LABEL_SEARCH_ZERO,
+        &&LABEL_SCAN, &&LABEL_SET_MULTIPLIER, &&LABEL_SET_MULTIPLIER_WIDE, &&LABEL_CALC_MULT,
+        &&LABEL_CALC_MULT_WIDE, &&LABEL_END,
+        SUPER_LABELS
+    };
+    Cell *mem = membuf;
+    Cell mult = 0;
+    Word *pc = code + bytecode.at[start];
+
+#define NEXT_LABEL \
+    goto *handlers[*pc]
+
+    NEXT_LABEL;
+LABEL_GET:
+    SUPER_GET
+    NEXT_LABEL;
+LABEL_PUT:
+    SUPER_PUT
+    NEXT_LABEL;
+LABEL_OPEN:
+    SUPER_OPEN
+    NEXT_LABEL;
+LABEL_CLOSE:
+    SUPER_CLOSE
+LABEL_CALC:
+    SUPER_CALC
+    NEXT_LABEL;
+LABEL_CALC_WIDE:
+    mem[pc[1]] += pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_MOVE:
+    SUPER_MOVE
+    NEXT_LABEL;
+LABEL_LOAD:
+    SUPER_LOAD
+    NEXT_LABEL;
+LABEL_LOAD_WIDE:
+    mem[pc[1]] = pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_MEM_MOVE:
+    SUPER_MEM_MOVE
+    NEXT_LABEL;
+LABEL_SEARCH_ZERO:
+    while (*mem != 0)
+        mem += pc[1];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_SCAN:
+    mem = (Cell*) scan(mem, pc[1]);
+    pc += 3;
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER:
+    SUPER_SET_MULTIPLIER
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER_WIDE:
+    mult = mem[pc[1]] * (Cell) pc[2];
+    mem[pc[1]] = 0;
+    pc += 3;
+    NEXT_LABEL;
+LABEL_CALC_MULT:
+    SUPER_CALC_MULT
+    NEXT_LABEL;
+LABEL_CALC_MULT_WIDE:
+    mem[pc[1]] += mult * (Cell) pc[2];
+    pc += 3;
+    NEXT_LABEL;
+SUPER_HANDLERS
+LABEL_END:
+    io_flush(io);
+#undef NEXT_LABEL
+}
+
+// what execute_cached() knows about the cell under the pointer: DIRTY
+// only the local has it, CLEAN the local and *mem have it, FLUSHED only
+// *mem has it
+enum CellState {
+    DIRTY, CLEAN, FLUSHED
+};
+// Direct threading with the cell under the pointer in a local, which the
+// compiler keeps in a register. Its state at every instruction is known
+// when the records are built: loops are entered and left CLEAN, and every
+// instruction in between gets the handler for the state the one before
+// it leaves.
+//
+// Handlers that do not touch *mem run in every state and keep it. On *mem
+// with offset 0 the _C0 handlers use the local and leave it DIRTY, the
+// _F0 ones load it first. Pointer moves, scans, MEM_MOVE into or out of
+// *mem and wide records work on memory: their _D handlers write the
+// local back first, and they leave it FLUSHED. CLOSE tests its loop
+// itself instead of going back to the OPEN, whose handler is the one for
+// the state before the loop.
+template <typename Cell>
+void execute_cached(const std::vector<Instruction> &insns, size_t start, Cell *membuf, IO *io) {
+    Bytecode<Cell> bytecode(insns, false, NULL);
+    Word *code = bytecode.code;
+    ScanFunc scan = bytecode.scan;
+    char *base = (char*) &&LABEL_END;
+    CellState state = CLEAN;
+    for (size_t pc = 0; pc < insns.size(); ++pc) {
+        const Instruction &insn = insns[pc];
+        Word *record = code + bytecode.at[pc];
+        bool zero = insn.offset == 0;
+        // the handler in every state, and the state after it
+        void *handlers[3];
+        CellState next = state;
+#define ALL_STATES(label) \
+    handlers[DIRTY] = handlers[CLEAN] = handlers[FLUSHED] = &&label
+        switch ((Handler) *record) {
+            case H_GET:
+                ALL_STATES(LABEL_GET);
+                if (zero) {
+                    ALL_STATES(LABEL_GET_C0);
+                    next = DIRTY;
+                }
+                break;
+            case H_PUT:
+                ALL_STATES(LABEL_PUT);
+                if (zero)
+                    handlers[DIRTY] = handlers[CLEAN] = &&LABEL_PUT_C0;
+                break;
+            case H_OPEN:
+                if (zero) {
+                    handlers[DIRTY] = &&LABEL_OPEN_D0;
+                    handlers[CLEAN] = &&LABEL_OPEN_C0;
+                    handlers[FLUSHED] = &&LABEL_OPEN_F0;
+                } else {
+                    handlers[DIRTY] = &&LABEL_OPEN_D;
+                    handlers[CLEAN] = &&LABEL_OPEN;
+                    handlers[FLUSHED] = &&LABEL_OPEN_F;
+                }
+                next = CLEAN;
+                break;
+            case H_CLOSE:
+                if (insns[pc - insn.value.i1 + 1].offset == 0) {
+                    handlers[DIRTY] = &&LABEL_CLOSE_D0;
+                    handlers[CLEAN] = &&LABEL_CLOSE_C0;
+                    handlers[FLUSHED] = &&LABEL_CLOSE_F0;
+                } else {
+                    handlers[DIRTY] = &&LABEL_CLOSE_D;
+                    handlers[CLEAN] = &&LABEL_CLOSE;
+                    handlers[FLUSHED] = &&LABEL_CLOSE_F;
+                }
+                next = CLEAN;
+                break;
+            case H_CALC:
+                ALL_STATES(LABEL_CALC);
+                if (zero) {
+                    handlers[DIRTY] = handlers[CLEAN] = &&LABEL_CALC_C0;
+                    handlers[FLUSHED] = &&LABEL_CALC_F0;
+                    next = DIRTY;
+                }
+                break;
+            case H_CALC_WIDE:
+                ALL_STATES(LABEL_CALC_WIDE);
+                if (zero) {
+                    handlers[DIRTY] = &&LABEL_CALC_WIDE_D;
+                    next = FLUSHED;
+                }
+                break;
+            case H_MOVE:
+                ALL_STATES(LABEL_MOVE);
+                handlers[DIRTY] = &&LABEL_MOVE_D;
+                next = FLUSHED;
+                break;
+            case H_LOAD:
+                ALL_STATES(LABEL_LOAD);
+                if (zero) {
+                    ALL_STATES(LABEL_LOAD_C0);
+                    next = DIRTY;
+                }
+                break;
+            case H_LOAD_WIDE:
+                ALL_STATES(LABEL_LOAD_WIDE);
+                if (zero) {
+                    handlers[DIRTY] = &&LABEL_LOAD_WIDE_D;
+                    next = FLUSHED;
+                }
+                break;
+            case H_MEM_MOVE:
+                ALL_STATES(LABEL_MEM_MOVE);
+                if (zero || insn.offset + insn.value.s2.s0 == 0) {
+                    handlers[DIRTY] = &&LABEL_MEM_MOVE_D;
+                    next = FLUSHED;
+                }
+                break;
+            case H_SEARCH_ZERO:
+                ALL_STATES(LABEL_SEARCH_ZERO);
+                handlers[DIRTY] = &&LABEL_SEARCH_ZERO_D;
+                next = FLUSHED;
+                break;
+            case H_SCAN:
+                ALL_STATES(LABEL_SCAN);
+                handlers[DIRTY] = &&LABEL_SCAN_D;
+                next = FLUSHED;
+                break;
+            case H_SET_MULTIPLIER:
+                ALL_STATES(LABEL_SET_MULTIPLIER);
+                if (zero) {
+                    handlers[DIRTY] = handlers[CLEAN] = &&LABEL_SET_MULTIPLIER_C0;
+                    handlers[FLUSHED] = &&LABEL_SET_MULTIPLIER_F0;
+                    next = DIRTY;
+                }
+                break;
+            case H_SET_MULTIPLIER_WIDE:
+                ALL_STATES(LABEL_SET_MULTIPLIER_WIDE);
+                if (zero) {
+                    handlers[DIRTY] = &&LABEL_SET_MULTIPLIER_WIDE_D;
+                    next = FLUSHED;
+                }
+                break;
+            case H_CALC_MULT:
+                ALL_STATES(LABEL_CALC_MULT);
+                if (zero) {
+                    handlers[DIRTY] = handlers[CLEAN] = &&LABEL_CALC_MULT_C0;
+                    handlers[FLUSHED] = &&LABEL_CALC_MULT_F0;
+                    next = DIRTY;
+                }
+                break;
+            case H_CALC_MULT_WIDE:
+                ALL_STATES(LABEL_CALC_MULT_WIDE);
+                if (zero) {
+                    handlers[DIRTY] = &&LABEL_CALC_MULT_WIDE_D;
+                    next = FLUSHED;
+                }
+                break;
+            default:
+                ALL_STATES(LABEL_END);
+                handlers[DIRTY] = &&LABEL_END_D;
+                break;
+        }
+#undef ALL_STATES
+        record[0] = (Word) ((char*) handlers[state] - base);
+        state = next;
+    }
+    Cell *mem = membuf;
+    Cell cell = *mem;
+    Cell mult = 0;
+    Word *pc = code + bytecode.at[start];
+
+#define NEXT_LABEL \
+    goto *(void*) (base + *pc)
+
+    NEXT_LABEL;
+LABEL_GET:
+    SUPER_GET
+    NEXT_LABEL;
+LABEL_GET_C0:
+    cell = io_get(io);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_PUT:
+    SUPER_PUT
+    NEXT_LABEL;
+LABEL_PUT_C0:
+    io_put(io, cell);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_OPEN_D:
+    *mem = cell;
+    goto LABEL_OPEN;
+LABEL_OPEN_F:
+    cell = *mem;
+    // fall through
+LABEL_OPEN:
+    SUPER_OPEN
+    NEXT_LABEL;
+LABEL_OPEN_D0:
+    *mem = cell;
+    goto LABEL_OPEN_C0;
+LABEL_OPEN_F0:
+    cell = *mem;
+    // fall through
+LABEL_OPEN_C0:
+    if (cell == 0)
+        pc = *(Target*) (pc + 2);
+    else
+        pc += 2 + TARGET_WORDS;
+    NEXT_LABEL;
+LABEL_CLOSE_D:
+    *mem = cell;
+    goto LABEL_CLOSE;
+LABEL_CLOSE_F:
+    cell = *mem;
+    // fall through
+LABEL_CLOSE: {
+    Word *head = *(Target*) (pc + 1);
+    if (mem[head[1]] != 0)
+        pc = head + 2 + TARGET_WORDS;
+    else
+        pc += 1 + TARGET_WORDS;
+    NEXT_LABEL;
+}
+LABEL_CLOSE_D0:
+    *mem = cell;
+    goto LABEL_CLOSE_C0;
+LABEL_CLOSE_F0:
+    cell = *mem;
+    // fall through
+LABEL_CLOSE_C0:
+    if (cell != 0)
+        pc = *(Target*) (pc + 1) + 2 + TARGET_WORDS;
+    else
+        pc += 1 + TARGET_WORDS;
+    NEXT_LABEL;
+LABEL_CALC:
+    SUPER_CALC
+    NEXT_LABEL;
+LABEL_CALC_F0:
+    cell = *mem;
+    // fall through
+LABEL_CALC_C0:
+    cell += VALUE16(pc[1]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_CALC_WIDE_D:
+    *mem = cell;
+    // fall through
+LABEL_CALC_WIDE:
+    mem[pc[1]] += pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_MOVE_D:
+    *mem = cell;
+    // fall through
+LABEL_MOVE:
+    SUPER_MOVE
+    NEXT_LABEL;
+LABEL_LOAD:
+    SUPER_LOAD
+    NEXT_LABEL;
+LABEL_LOAD_C0:
+    cell = VALUE16(pc[1]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_LOAD_WIDE_D:
+    *mem = cell;
+    // fall through
+LABEL_LOAD_WIDE:
+    mem[pc[1]] = pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_MEM_MOVE_D:
+    *mem = cell;
+    // fall through
+LABEL_MEM_MOVE:
+    SUPER_MEM_MOVE
+    NEXT_LABEL;
+LABEL_SEARCH_ZERO_D:
+    *mem = cell;
+    // fall through
+LABEL_SEARCH_ZERO:
+    while (*mem != 0)
+        mem += pc[1];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_SCAN_D:
+    *mem = cell;
+    // fall through
+LABEL_SCAN:
+    mem = (Cell*) scan(mem, pc[1]);
+    pc += 3;
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER:
+    SUPER_SET_MULTIPLIER
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER_F0:
+    cell = *mem;
+    // fall through
+LABEL_SET_MULTIPLIER_C0:
+    mult = cell * (Cell) VALUE16(pc[1]);
+    cell = 0;
+    pc += 2;
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER_WIDE_D:
+    *mem = cell;
+    // fall through
+LABEL_SET_MULTIPLIER_WIDE:
+    mult = mem[pc[1]] * (Cell) pc[2];
+    mem[pc[1]] = 0;
+    pc += 3;
+    NEXT_LABEL;
+LABEL_CALC_MULT:
+    SUPER_CALC_MULT
+    NEXT_LABEL;
+LABEL_CALC_MULT_F0:
+    cell = *mem;
+    // fall through
+LABEL_CALC_MULT_C0:
+    cell += mult * (Cell) VALUE16(pc[1]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_CALC_MULT_WIDE_D:
+    *mem = cell;
+    // fall through
+LABEL_CALC_MULT_WIDE:
+    mem[pc[1]] += mult * (Cell) pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_END_D:
+    *mem = cell;
+    // fall through
+LABEL_END:
+    io_flush(io);
+#undef NEXT_LABEL
+}
+
+// what the handlers of call threading share, the generated code keeps a
+// pointer to it in a callee-saved register
+template <typename Cell>
+struct CallState {
+    Cell *mem;
+    Cell mult;
+    IO *io;
+    ScanFunc scan;
+};
+// the handlers, called with the state and the record
+template <typename Cell>
+struct CallHandlers {
+    typedef CallState<Cell> State;
+    static void get(State *s, const Word *pc) {
+        s->mem[pc[1]] = io_get(s->io);
+    }
+    static void put(State *s, const Word *pc) {
+        io_put(s->io, s->mem[pc[1]]);
+    }
+    // whether the loop is skipped
+    static int open(State *s, const Word *pc) {
+        return s->mem[pc[1]] == 0;
+    }
+    static void calc(State *s, const Word *pc) {
+        s->mem[OFFSET16(pc[1])] += VALUE16(pc[1]);
+    }
+    static void calc_wide(State *s, const Word *pc) {
+        s->mem[pc[1]] += pc[2];
+    }
+    static void move(State *s, const Word *pc) {
+        s->mem += pc[1];
+    }
+    static void load(State *s, const Word *pc) {
+        s->mem[OFFSET16(pc[1])] = VALUE16(pc[1]);
+    }
+    static void load_wide(State *s, const Word *pc) {
+        s->mem[pc[1]] = pc[2];
+    }
+    static void mem_move(State *s, const Word *pc) {
+        Cell *mem = s->mem;
+        mem[pc[1] + VALUE16(pc[2] >> 16)] += mem[pc[1]] * VALUE16(pc[2]);
+        mem[pc[1]] = 0;
+    }
+    static void search_zero(State *s, const Word *pc) {
+        Cell *mem = s->mem;
+        while (*mem != 0)
+            mem += pc[1];
+        s->mem = mem;
+    }
+    static void scan(State *s, const Word *pc) {
+        s->mem = (Cell*) s->scan(s->mem, pc[1]);
+    }
+    static void set_multiplier(State *s, const Word *pc) {
+        s->mult = s->mem[OFFSET16(pc[1])] * (Cell) VALUE16(pc[1]);
+        s->mem[OFFSET16(pc[1])] = 0;
+    }
+    static void set_multiplier_wide(State *s, const Word *pc) {
+        s->mult = s->mem[pc[1]] * (Cell) pc[2];
+        s->mem[pc[1]] = 0;
+    }
+    static void calc_mult(State *s, const Word *pc) {
+        s->mem[OFFSET16(pc[1])] += s->mult * (Cell) VALUE16(pc[1]);
+    }
+    static void calc_mult_wide(State *s, const Word *pc) {
+        s->mem[pc[1]] += s->mult * (Cell) pc[2];
+    }
+    static void end(State *s, const Word *) {
+        io_flush(s->io);
+    }
+};
+// x86 and x86-64 code for call threading, position independent until it
+// is copied to executable memory
+class CallCode {
+private:
+    std::vector<unsigned char> bytes;
+    void *map;
+    CallCode(const CallCode&);
+    CallCode &operator=(const CallCode&);
+    void emit(const char *code, size_t n) {
+        bytes.insert(bytes.end(), code, code + n);
+    }
+    void imm32(uint32_t n) {
+        for (int i = 0; i < 4; ++i)
+            bytes.push_back(n >> (i * 8));
+    }
+    void imm(uintptr_t n) {
+        for (size_t i = 0; i < sizeof(n); ++i)
+            bytes.push_back(n >> (i * 8));
+    }
+public:
+    CallCode() : map(NULL) {
+    }
+    ~CallCode() {
+        if (map != NULL)
+            munmap(map, bytes.size());
+    }
+    size_t size() const {
+        return bytes.size();
+    }
+    // keeps the state, the first argument, in rbx / ebx, with the stack
+    // aligned for calls
+    void prologue() {
+#ifdef __x86_64__
+        emit("\x53\x48\x89\xfb", 4);            // push rbx; mov rbx, rdi
+#else
+        emit("\x53\x8b\x5c\x24\x08", 5);        // push ebx; mov ebx, [esp+8]
+        emit("\x83\xec\x18", 3);                // sub esp, 24
+#endif
+    }
+    void epilogue() {
+#ifndef __x86_64__
+        emit("\x83\xc4\x18", 3);                // add esp, 24
+#endif
+        emit("\x5b\xc3", 2);                    // pop rbx; ret
+    }
+    // handler(state, record)
+    void call(uintptr_t handler, const Word *record) {
+#ifdef __x86_64__
+        emit("\x48\x89\xdf\x48\xbe", 5);        // mov rdi, rbx; mov rsi, record
+        imm((uintptr_t) record);
+        emit("\x48\xb8", 2);                    // mov rax, handler
+        imm(handler);
+#else
+        emit("\xc7\x44\x24\x04", 4);            // mov [esp+4], record
+        imm((uintptr_t) record);
+        emit("\x89\x1c\x24\xb8", 4);            // mov [esp], ebx; mov eax, handler
+        imm(handler);
+#endif
+        emit("\xff\xd0", 2);                    // call eax
+    }
+    // jumps when the last call returned nonzero, returns where the
+    // displacement goes for patch()
+    size_t jump_if_true() {
+        emit("\x85\xc0\x0f\x85", 4);            // test eax, eax; jnz
+        imm32(0);
+        return bytes.size() - 4;
+    }
+    size_t jump() {
+        emit("\xe9", 1);
+        imm32(0);
+        return bytes.size() - 4;
+    }
+    void patch(size_t at, size_t target) {
+        uint32_t rel = (uint32_t) (target - (at + 4));
+        for (int i = 0; i < 4; ++i)
+            bytes[at + i] = rel >> (i * 8);
+    }
+    // the code in executable memory, from the first byte emitted
+    void *finish() {
+        map = mmap(NULL, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+            throw "code allocation failed";
+        }
+        memcpy(map, &bytes[0], bytes.size());
+        if (mprotect(map, bytes.size(), PROT_READ | PROT_EXEC) != 0)
+            throw "code allocation failed";
+        return map;
+    }
+};
+
+#define CALL_HANDLER(name) ((uintptr_t) &CallHandlers<Cell>::name)
+
+template <typename Cell>
+void execute_call(const std::vector<Instruction> &insns, size_t start, Cell *membuf, IO *io) {
+    Bytecode<Cell> bytecode(insns, false, NULL);
+    // in the order of Handler, OPEN and CLOSE are emitted apart
+    const uintptr_t handlers[] = {
+        CALL_HANDLER(get), CALL_HANDLER(put), 0, 0, CALL_HANDLER(calc), CALL_HANDLER(calc_wide),
+        CALL_HANDLER(move), CALL_HANDLER(load), CALL_HANDLER(load_wide), CALL_HANDLER(mem_move),
+        CALL_HANDLER(search_zero), CALL_HANDLER(scan), CALL_HANDLER(set_multiplier),
+        CALL_HANDLER(set_multiplier_wide), CALL_HANDLER(calc_mult), CALL_HANDLER(calc_mult_wide),
+        CALL_HANDLER(end),
+    };
+    CallCode code;
+    code.prologue();
+    size_t entry = code.jump();
+    // where the code of every instruction starts, and the jumps of the
+    // OPENs to the instructions after their CLOSEs
+    std::vector<size_t> at(insns.size());
+    std::vector<std::pair<size_t, size_t> > forward;
+    for (size_t pc = 0; pc < insns.size(); ++pc) {
+        const Instruction &insn = insns[pc];
+        Word *record = bytecode.code + bytecode.at[pc];
+        at[pc] = code.size();
+        switch (*record) {
+            case H_OPEN:
+                code.call(CALL_HANDLER(open), record);
+                forward.push_back(std::make_pair(code.jump_if_true(), pc + insn.value.i1 + 1));
+                break;
+            case H_CLOSE:
+                code.patch(code.jump(), at[pc - insn.value.i1 + 1]);
+                break;
+            case H_END:
+                code.call(CALL_HANDLER(end), record);
+                code.epilogue();
+                break;
+            default:
+                code.call(handlers[*record], record);
+                break;
+        }
+    }
+    code.patch(entry, at[start]);
+    for (size_t i = 0; i < forward.size(); ++i)
+        code.patch(forward[i].first, at[forward[i].second]);
+    CallState<Cell> state = { membuf, 0, io, bytecode.scan };
+    ((void (*)(CallState<Cell>*)) code.finish())(&state);
+}
+
+#undef CALL_HANDLER
+
+// insns run by dispatch, super as execute() takes it
+template <typename Cell>
+void execute_dispatch(Dispatch dispatch, const std::vector<Instruction> &insns, size_t start,
+        Cell *membuf, IO *io, bool super = true) {
+    switch (dispatch) {
+        case DISPATCH_SWITCH:
+            execute_switch<Cell>(insns, start, membuf, io);
+            break;
+        case DISPATCH_TOKEN:
+            execute_token<Cell>(insns, start, membuf, io, super);
+            break;
+        case DISPATCH_CALL:
+            execute_call<Cell>(insns, start, membuf, io);
+            break;
+        case DISPATCH_CACHED:
+            execute_cached<Cell>(insns, start, membuf, io);
+            break;
+        default:
+            execute<Cell>(insns, start, membuf, io, NULL, NULL, super);
+            break;
+    }
+}
+
+#endif
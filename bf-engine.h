@@ -0,0 +1,155 @@
+#ifndef BF_ENGINE_H
+#define BF_ENGINE_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <xbyak/xbyak.h>
+
+#include "bf-codegen.h"
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-lex.h"
+#include "bf-tape.h"
+#include "bf-vm.h"
+
+// The engines as a library. A Program is compiled once, by the VM or the
+// JIT backend, and never changes after that: run() may be called any
+// number of times and from any number of threads at once. Every run has
+// its own tape and its own I/O, on descriptors, on callbacks or on
+// strings in memory.
+//
+//   EngineOptions options;
+//   options.backend = BACKEND_JIT;
+//   Program<uint32_t> program(text, text + size, options);
+//   std::string output = program.run("input");
+//
+// The JIT code takes the tape and the IO as arguments (Jit::reentrant()),
+// the VM bytecode is encoded and threaded once and then only read, so
+// nothing a run writes is shared. One thread runs one program at a time.
+#define ENGINE_CELLS 30000
+
+enum Backend {
+    BACKEND_VM, BACKEND_JIT
+};
+struct EngineOptions {
+    Backend backend;
+    FlushPolicy policy;
+    bool grow_left, huge_pages;
+    PassManager passes;
+    EngineOptions() : backend(BACKEND_JIT), policy(FLUSH_FULL),
+        grow_left(false), huge_pages(false) {
+    }
+};
+// input and output of run(const std::string &)
+struct StringIO {
+    const std::string *input;
+    size_t read;
+    std::string *output;
+};
+long read_string(void *context, void *buf, size_t n) {
+    StringIO *io = (StringIO*) context;
+    size_t left = io->input->size() - io->read;
+    if (n > left)
+        n = left;
+    memcpy(buf, io->input->data() + io->read, n);
+    io->read += n;
+    return n;
+}
+long write_string(void *context, const void *buf, size_t n) {
+    ((StringIO*) context)->output->append((const char*) buf, n);
+    return n;
+}
+template <typename Cell>
+class Program {
+private:
+    std::vector<Instruction> insns;
+    Snapshot<Cell> snapshot;
+    EngineOptions options;
+    Xbyak::CodeGenerator *gen;
+    void (*code)(Cell *membuf, IO *io);
+    // the VM backend's, shared by its runs
+    Bytecode<Cell> *bytecode;
+    // not copyable, code belongs to gen
+    Program(const Program&);
+    Program &operator=(const Program&);
+public:
+    // throws const char * like the engines when text does not parse
+    Program(const char *begin, const char *end, const EngineOptions &options = EngineOptions()) :
+        options(options), gen(NULL), code(NULL), bytecode(NULL) {
+        compile<Cell>(insns, snapshot, Source(begin, end), this->options.passes);
+        if (options.backend != BACKEND_JIT) {
+            bytecode = new Bytecode<Cell>(insns, false, NULL);
+            execute<Cell>(*bytecode, insns, snapshot.pc, NULL, NULL);
+            return;
+        }
+        // only its policy is taken, every run passes its own IO
+        IO image;
+        io_init(&image, options.policy);
+        gen = new Xbyak::CodeGenerator(code_size(insns, 0, insns.size() - 1));
+        Jit<Cell> jit(*gen, insns, &image);
+        jit.reentrant();
+        jit.program(snapshot.pc, NULL);
+        code = (void (*)(Cell*, IO*)) gen->getCode();
+    }
+    ~Program() {
+        delete gen;
+        delete bytecode;
+    }
+    // the instructions and what the passes did, for -debug and -stats
+    const std::vector<Instruction> &instructions() const {
+        return insns;
+    }
+    const PassManager &passes() const {
+        return options.passes;
+    }
+    // a tape as the runs of this program want it, one per thread
+    Tape *new_tape() const {
+        return new Tape(ENGINE_CELLS * sizeof(Cell), options.grow_left, options.huge_pages);
+    }
+    // a run on io, set up by io_init() with any policy, and on tape,
+    // which is zeroed; the program flushes io as it was compiled to
+    void run(IO *io, Tape &tape) const {
+        io->policy = options.policy;
+        io->out_end = io->out_buf + (options.policy == FLUSH_NONE ? 1 : IOBUFSIZE);
+        Cell *head = snapshot.restore((Cell*) tape.head());
+        io_write(io, snapshot.output.data(), snapshot.output.size());
+        if (code != NULL)
+            code(head, io);
+        else
+            execute<Cell>(*bytecode, insns, snapshot.pc, head, io);
+    }
+    // a run on io and a tape of its own
+    void run(IO *io) const {
+        Tape tape(ENGINE_CELLS * sizeof(Cell), options.grow_left, options.huge_pages);
+        run(io, tape);
+    }
+    // a run reading in_fd and writing out_fd
+    void run(int in_fd, int out_fd) const {
+        std::vector<IO> io(1);
+        io_init(&io[0], options.policy);
+        io[0].in_fd = in_fd;
+        io[0].out_fd = out_fd;
+        run(&io[0]);
+    }
+    // a run on callbacks, which get context
+    void run(ReadFunc reader, WriteFunc writer, void *context) const {
+        std::vector<IO> io(1);
+        io_init(&io[0], options.policy);
+        io[0].reader = reader;
+        io[0].writer = writer;
+        io[0].context = context;
+        run(&io[0]);
+    }
+    // a run on input in memory, returns the output
+    std::string run(const std::string &input) const {
+        std::string output;
+        StringIO context = { &input, 0, &output };
+        run(read_string, write_string, &context);
+        return output;
+    }
+};
+
+#endif
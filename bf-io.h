@@ -0,0 +1,114 @@
+#ifndef BF_IO_H
+#define BF_IO_H
+
+#include <cerrno>
+#include <cstddef>
+#include <unistd.h>
+
+#define IOBUFSIZE 65536
+
+enum FlushPolicy {
+    FLUSH_FULL, FLUSH_LINE, FLUSH_NONE
+};
+// read(2) and write(2) on something else than a descriptor: the bytes
+// moved, 0 at the end of the input, -1 on errors. Output a writer does not
+// take, returning 0 or -1, is dropped.
+typedef long (*ReadFunc)(void *context, void *buf, size_t n);
+typedef long (*WriteFunc)(void *context, const void *buf, size_t n);
+
+// Buffers for , and . owned by the engine instead of stdio.
+// Output is flushed when the buffer fills, before every read and at END,
+// and additionally after each '\n' under FLUSH_LINE.
+// FLUSH_NONE is a one-byte buffer, so that emitted code only has to
+// compare out_pos with out_end for every policy.
+struct IO {
+    unsigned char *out_pos;
+    unsigned char *out_end;
+    unsigned char *in_pos;
+    unsigned char *in_end;
+    FlushPolicy policy;
+    int in_fd, out_fd;
+    unsigned char out_buf[IOBUFSIZE];
+    unsigned char in_buf[IOBUFSIZE];
+    // used instead of in_fd and out_fd when set; the code
+    // emit_io_routines() emits always uses the descriptors
+    ReadFunc reader;
+    WriteFunc writer;
+    void *context;
+};
+inline void io_init(IO *io, FlushPolicy policy) {
+    io->policy = policy;
+    io->in_fd = STDIN_FILENO;
+    io->out_fd = STDOUT_FILENO;
+    io->out_pos = io->out_buf;
+    io->out_end = io->out_buf + (policy == FLUSH_NONE ? 1 : IOBUFSIZE);
+    io->in_pos = io->in_end = io->in_buf;
+    io->reader = NULL;
+    io->writer = NULL;
+    io->context = NULL;
+}
+inline ssize_t io_read_some(IO *io, void *buf, size_t n) {
+    if (io->reader == NULL)
+        return read(io->in_fd, buf, n);
+    long result = io->reader(io->context, buf, n);
+    if (result < 0)
+        errno = EIO;
+    return result;
+}
+inline ssize_t io_write_some(IO *io, const void *buf, size_t n) {
+    if (io->writer == NULL)
+        return write(io->out_fd, buf, n);
+    long result = io->writer(io->context, buf, n);
+    if (result < 0)
+        errno = EIO;
+    return result;
+}
+inline void io_flush(IO *io) {
+    unsigned char *p = io->out_buf;
+    while (p < io->out_pos) {
+        ssize_t n = io_write_some(io, p, io->out_pos - p);
+        if (n < 0 && errno == EINTR)
+            continue;
+        // a writer that takes nothing would be retried forever
+        if (n <= 0)
+            break;
+        p += n;
+    }
+    io->out_pos = io->out_buf;
+}
+// writes n bytes at once, after what is buffered
+inline void io_write(IO *io, const void *data, size_t n) {
+    io_flush(io);
+    const unsigned char *p = (const unsigned char*) data;
+    while (n > 0) {
+        ssize_t written = io_write_some(io, p, n);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+        p += written;
+        n -= written;
+    }
+}
+// returns -1 at EOF like getchar()
+inline int io_get(IO *io) {
+    io_flush(io);
+    if (io->in_pos == io->in_end) {
+        ssize_t n;
+        do {
+            n = io_read_some(io, io->in_buf, IOBUFSIZE);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return -1;
+        io->in_pos = io->in_buf;
+        io->in_end = io->in_buf + n;
+    }
+    return *io->in_pos++;
+}
+inline void io_put(IO *io, int ch) {
+    *io->out_pos++ = ch;
+    if (io->out_pos == io->out_end || (io->policy == FLUSH_LINE && ch == '\n'))
+        io_flush(io);
+}
+
+#endif
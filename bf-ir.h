@@ -0,0 +1,864 @@
+#ifndef BF_IR_H
+#define BF_IR_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include "bf-lex.h"
+
+// A program is parsed into a tree of Nodes, rewritten by the passes of an
+// Optimizer until none of them changes it any more, and then lowered into
+// the flat Instruction stream both engines execute.
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// ADD     p[offset] += value
+// SHIFT   p += value
+// SET     p[offset] = value
+// IN, OUT , and . on p[offset]
+// LOOP    [body] testing p[offset]
+// SCAN    p += value until *p == 0
+// LINEAR  a loop with counter p[offset] that runs p[offset] * value times;
+//         body holds an ADD of the per-iteration delta for every cell it
+//         adds to, and a SET of the final value for every cell it sets.
+enum NodeKind {
+    ADD, SHIFT, SET, IN, OUT, LOOP, SCAN, LINEAR
+};
+struct Node {
+    NodeKind kind;
+    int value;
+    int offset;
+    std::vector<Node> body;
+    // source position of the [ of loops, 0 otherwise
+    int line, column;
+    Node() : kind(ADD), value(0), offset(0), line(0), column(0) {
+    }
+    Node(NodeKind kind, int value = 0, int offset = 0) :
+        kind(kind), value(value), offset(offset), line(0), column(0) {
+    }
+};
+
+// Version of what a compiled program looks like. Bump it on any change to
+// Instruction, the passes, lower() or Jit, so caches keyed on it
+// (bf-cache.h) never return code from an older compiler.
+#define CODE_VERSION 4
+
+enum Opcode {
+    GET = 0, PUT, OPEN, CLOSE, END,
+    CALC, MOVE, LOAD, SEARCH_ZERO,
+    SET_MULTIPLIER, CALC_MULT, MEM_MOVE,
+};
+const char *OPCODE_NAMES[] = {
+    ",", ".", "[", "]", "",
+    "c", "m", "l", "s",
+    "X", "x", "M",
+};
+union Value {
+    int i1;
+    struct {
+        short s0, s1;
+    } s2;
+};
+// OPEN/CLOSE: i1 is the distance to the matching CLOSE / to OPEN - 1
+// SET_MULTIPLIER: multiplier = p[offset] * i1, p[offset] = 0
+// CALC_MULT: p[offset] += multiplier * i1
+// MEM_MOVE: p[offset + s0] += p[offset] * s1, p[offset] = 0
+class Instruction {
+public:
+    Opcode op;
+    Value value;
+    // cell the instruction works on, relative to the pointer
+    int offset;
+    // source position of the loop a loop head comes from, 0 otherwise
+    int line, column;
+    Instruction(Opcode op) : op(op), offset(0), line(0), column(0) {
+    }
+    Instruction(Opcode op, int i1, int offset = 0) :
+        op(op), offset(offset), line(0), column(0) {
+        this->value.i1 = i1;
+    }
+    Instruction(Opcode op, short s0, short s1, int offset) :
+        op(op), offset(offset), line(0), column(0) {
+        this->value.s2.s0 = s0;
+        this->value.s2.s1 = s1;
+    }
+};
+
+void append(std::vector<Node> &block, const Node &node) {
+    if (!block.empty() && (node.kind == ADD || node.kind == SHIFT) &&
+            block.back().kind == node.kind && block.back().offset == node.offset) {
+        block.back().value += node.value;
+        return;
+    }
+    block.push_back(node);
+}
+// Comments are skipped and runs of + - > < counted 16 bytes at a time,
+// each run becomes one node.
+void parse(std::vector<Node> &program, const char *begin, const char *end) {
+    std::vector<std::vector<Node> > blocks(1);
+    std::vector<Node> loops;
+    bool vector = __builtin_cpu_supports("sse2");
+    const char *line_start = begin;
+    int line = 1;
+    for (const char *p = skip_comment(begin, end, vector); p < end; p = skip_comment(p, end, vector)) {
+        switch (*p) {
+            case '\n':
+                ++line;
+                line_start = ++p;
+                break;
+            case '+':
+            case '-':
+            case '>':
+            case '<': {
+                int n = run_length(p, end, vector);
+                if (*p == '+' || *p == '-')
+                    append(blocks.back(), Node(ADD, *p == '+' ? n : -n));
+                else
+                    append(blocks.back(), Node(SHIFT, *p == '>' ? n : -n));
+                p += n;
+                break;
+            }
+            case ',':
+                blocks.back().push_back(Node(IN));
+                ++p;
+                break;
+            case '.':
+                blocks.back().push_back(Node(OUT));
+                ++p;
+                break;
+            case '[':
+                blocks.push_back(std::vector<Node>());
+                loops.push_back(Node(LOOP));
+                loops.back().line = line;
+                loops.back().column = p - line_start + 1;
+                ++p;
+                break;
+            case ']': {
+                if (blocks.size() == 1)
+                    throw "unbalanced ]";
+                std::vector<Node> &parent = blocks[blocks.size() - 2];
+                parent.push_back(loops.back());
+                parent.back().body.swap(blocks.back());
+                blocks.pop_back();
+                loops.pop_back();
+                ++p;
+                break;
+            }
+        }
+    }
+    if (blocks.size() != 1)
+        throw "unbalanced [";
+    program.swap(blocks[0]);
+}
+
+enum PassId {
+    PASS_FOLD, PASS_SET_FOLD, PASS_DEAD_LOOP, PASS_RESET_ZERO, PASS_SCAN, PASS_LINEAR,
+    PASS_OFFSETS, PASS_PREFIX,
+    PASS_COUNT
+};
+// the passes before PASS_OFFSETS run to a fixpoint on every block, loop
+// bodies before the blocks they are in, PASS_OFFSETS runs once after them
+// as the others expect pointer moves to be explicit, and PASS_PREFIX runs
+// on the lowered instructions
+const char *PASS_NAMES[] = {
+    "fold", "set-fold", "dead-loop", "reset-zero", "scan", "linear",
+    "offsets", "prefix",
+};
+#define MAX_ROUNDS 16
+#define PREFIX_BUDGET (1 << 20)
+
+// which passes run, and what they did
+class PassManager {
+public:
+    bool enabled[PASS_COUNT];
+    int runs[PASS_COUNT];
+    int changes[PASS_COUNT];
+    double time[PASS_COUNT];
+    // most rounds a block took
+    int rounds;
+    bool timing;
+    // instructions PASS_PREFIX may execute
+    long budget;
+    PassManager() : rounds(0), timing(false), budget(PREFIX_BUDGET) {
+        for (int i = 0; i < PASS_COUNT; ++i) {
+            enabled[i] = true;
+            runs[i] = changes[i] = 0;
+            time[i] = 0;
+        }
+    }
+    // -no-<pass>, -time-passes and -prefix-budget=<n>
+    bool parse_option(const char *option) {
+        if (strcmp(option, "-time-passes") == 0) {
+            timing = true;
+            return true;
+        }
+        if (strncmp(option, "-prefix-budget=", 15) == 0) {
+            budget = atol(option + 15);
+            return true;
+        }
+        if (strncmp(option, "-no-", 4) != 0)
+            return false;
+        for (int i = 0; i < PASS_COUNT; ++i) {
+            if (strcmp(option + 4, PASS_NAMES[i]) == 0) {
+                enabled[i] = false;
+                return true;
+            }
+        }
+        return false;
+    }
+    // start is only taken with timing, the passes run once per block
+    void record(int pass, double start, bool changed) {
+        if (timing)
+            time[pass] += now() - start;
+        ++runs[pass];
+        if (changed)
+            ++changes[pass];
+    }
+    void report(FILE *out) const {
+        fprintf(out, "%-12s %6s %8s %10s\n", "pass", "runs", "changes", "ms");
+        for (int i = 0; i < PASS_COUNT; ++i) {
+            fprintf(out, "%-12s %6d %8d %10.3f%s\n", PASS_NAMES[i],
+                    runs[i], changes[i], time[i], enabled[i] ? "" : " (disabled)");
+        }
+        fprintf(out, "%d rounds at most\n", rounds);
+    }
+};
+
+// what a loop body does to one cell per iteration
+struct Effect {
+    bool load;
+    int value;
+    int add;
+    Effect() : load(false), value(0), add(0) {
+    }
+};
+template <typename Cell>
+class Optimizer {
+private:
+    PassManager &passes;
+    static bool is_nop(const Node &node) {
+        return (node.kind == ADD && (Cell) node.value == 0) ||
+            (node.kind == SHIFT && node.value == 0);
+    }
+    // multiplicative inverse of an odd n modulo 2^(8 * sizeof(Cell))
+    static Cell inverse(Cell n) {
+        uint32_t x = n;
+        for (int i = 0; i < 4; ++i)
+            x *= 2 - (uint32_t) n * x;
+        return x;
+    }
+    // a pass on one block, whose loops are optimized already; clean if
+    // it is the whole program
+    bool run(int pass, std::vector<Node> &block, bool clean) {
+        switch (pass) {
+        case PASS_FOLD:
+            return fold(block);
+        case PASS_SET_FOLD:
+            return set_fold(block);
+        case PASS_DEAD_LOOP:
+            return dead_loop(block, clean);
+        case PASS_RESET_ZERO:
+            return reset_zero(block);
+        case PASS_SCAN:
+            return scan(block);
+        case PASS_LINEAR:
+            return linear(block);
+        default:
+            return false;
+        }
+    }
+    void timed_run(int pass, std::vector<Node> &block, bool clean, bool &changed) {
+        if (!passes.enabled[pass])
+            return;
+        double start = passes.timing ? now() : 0;
+        bool pass_changed = run(pass, block, clean);
+        passes.record(pass, start, pass_changed);
+        changed |= pass_changed;
+    }
+public:
+    Optimizer(PassManager &passes) : passes(passes) {
+    }
+    // Every pass only looks at one block and at the bodies of the loops in
+    // it, and nothing a pass does to a block enables more in the bodies, so
+    // each block is taken to its fixpoint once, after its loops. Neither
+    // this nor the passes recurse, deep nesting costs no stack.
+    void optimize(std::vector<Node> &program) {
+        // blocks in breadth-first order, so every body comes after its block
+        std::vector<std::vector<Node>*> blocks(1, &program);
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            std::vector<Node> &block = *blocks[b];
+            for (size_t i = 0; i < block.size(); ++i) {
+                if (block[i].kind == LOOP)
+                    blocks.push_back(&block[i].body);
+            }
+        }
+        // the passes move nodes of a block, and with them the bodies
+        // listed before it, which are done by then
+        for (size_t b = blocks.size(); b-- > 0;) {
+            bool changed = true;
+            int rounds = 0;
+            while (changed && rounds < MAX_ROUNDS) {
+                changed = false;
+                ++rounds;
+                for (int pass = 0; pass < PASS_OFFSETS; ++pass)
+                    timed_run(pass, *blocks[b], b == 0, changed);
+            }
+            if (rounds > passes.rounds)
+                passes.rounds = rounds;
+        }
+        if (passes.enabled[PASS_OFFSETS]) {
+            double start = passes.timing ? now() : 0;
+            // blocks and the move they are entered with, a body after its
+            // block has settled
+            std::vector<std::pair<std::vector<Node>*, int> > pending(1, std::make_pair(&program, 0));
+            while (!pending.empty()) {
+                std::vector<Node> &block = *pending.back().first;
+                int move = pending.back().second;
+                pending.pop_back();
+                int end = offsets(block, move);
+                if (&block != &program && end != move)
+                    block.push_back(Node(SHIFT, end - move));
+                for (size_t i = 0; i < block.size(); ++i) {
+                    if (block[i].kind == LOOP)
+                        pending.push_back(std::make_pair(&block[i].body, block[i].offset));
+                }
+            }
+            passes.record(PASS_OFFSETS, start, true);
+        }
+    }
+    // +++ -> +(3), >> -> >(2), drops what cancels out
+    bool fold(std::vector<Node> &block) {
+        bool changed = false;
+        size_t w = 0;
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            if (w > 0 && (node.kind == ADD || node.kind == SHIFT) &&
+                    block[w - 1].kind == node.kind && block[w - 1].offset == node.offset) {
+                block[w - 1].value += node.value;
+                changed = true;
+                if (is_nop(block[w - 1]))
+                    --w;
+                continue;
+            }
+            if (is_nop(node)) {
+                changed = true;
+                continue;
+            }
+            if (w != i)
+                std::swap(block[w], node);
+            ++w;
+        }
+        block.erase(block.begin() + w, block.end());
+        return changed;
+    }
+    // =(x)+(y) -> =(x+y), +(x)=(y) -> =(y), =(x)=(y) -> =(y)
+    bool set_fold(std::vector<Node> &block) {
+        bool changed = false;
+        size_t w = 0;
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            if (w > 0 && block[w - 1].offset == node.offset) {
+                Node &last = block[w - 1];
+                if (last.kind == SET && node.kind == ADD) {
+                    last.value += node.value;
+                    changed = true;
+                    continue;
+                }
+                if ((last.kind == SET || last.kind == ADD) && node.kind == SET) {
+                    last = node;
+                    changed = true;
+                    continue;
+                }
+            }
+            if (w != i)
+                std::swap(block[w], node);
+            ++w;
+        }
+        block.erase(block.begin() + w, block.end());
+        return changed;
+    }
+    // removes loops entered with a cell known to be zero: after another
+    // loop, a scan, =(0), or before anything was written to the tape
+    bool dead_loop(std::vector<Node> &block, bool clean) {
+        bool changed = false;
+        bool zero = clean;
+        size_t w = 0;
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            bool loop = node.kind == LOOP || node.kind == SCAN || node.kind == LINEAR;
+            if (loop && zero) {
+                changed = true;
+                continue;
+            }
+            switch (node.kind) {
+            case LOOP:
+                clean = false;
+                zero = true;
+                break;
+            case SCAN:
+            case LINEAR:
+                clean = false;
+                zero = true;
+                break;
+            case SHIFT:
+                zero = clean;
+                break;
+            case ADD:
+            case SET:
+            case IN:
+                clean = false;
+                if (node.offset == 0)
+                    zero = node.kind == SET && (Cell) node.value == 0;
+                break;
+            default:
+                break;
+            }
+            if (w != i)
+                std::swap(block[w], node);
+            ++w;
+        }
+        block.erase(block.begin() + w, block.end());
+        return changed;
+    }
+    // [+(n)] -> =(0) for odd n
+    bool reset_zero(std::vector<Node> &block) {
+        bool changed = false;
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            if (node.kind != LOOP)
+                continue;
+            if (node.body.size() == 1 && node.body[0].kind == ADD &&
+                    node.body[0].offset == 0 && (Cell) node.body[0].value % 2 == 1) {
+                node = Node(SET, 0);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+    // [>(n)] -> s(n)
+    bool scan(std::vector<Node> &block) {
+        bool changed = false;
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            if (node.kind != LOOP)
+                continue;
+            if (node.body.size() == 1 && node.body[0].kind == SHIFT) {
+                Node result(SCAN, node.body[0].value);
+                result.line = node.line;
+                result.column = node.column;
+                node = result;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+    // [A] -> LINEAR(inverse(-k)) { A' }
+    //   when A only adds to and sets cells, >< is balanced, and p[0]
+    //   changes by an odd k but is not set,
+    //   where A' adds the sum of what A adds to every cell once per
+    //   iteration, and sets every cell A sets to its final value.
+    bool linear(std::vector<Node> &block) {
+        bool changed = false;
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            if (node.kind != LOOP)
+                continue;
+            std::map<int, Effect> effects;
+            int move = 0;
+            bool linear = true;
+            for (size_t j = 0; linear && j < node.body.size(); ++j) {
+                const Node &insn = node.body[j];
+                switch (insn.kind) {
+                case SHIFT:
+                    move += insn.value;
+                    break;
+                case ADD:
+                    effects[move + insn.offset].add += insn.value;
+                    break;
+                case SET:
+                    effects[move + insn.offset].load = true;
+                    effects[move + insn.offset].value = insn.value;
+                    effects[move + insn.offset].add = 0;
+                    break;
+                default:
+                    linear = false;
+                    break;
+                }
+            }
+            if (!linear || move != 0 || effects[0].load)
+                continue;
+            Cell counter_delta = effects[0].add;
+            if (counter_delta % 2 == 0)
+                continue;
+            effects.erase(0);
+
+            Node result(LINEAR, (int) inverse(-counter_delta), node.offset);
+            result.line = node.line;
+            result.column = node.column;
+            for (std::map<int, Effect>::iterator it = effects.begin(); it != effects.end(); ++it) {
+                const Effect &effect = it->second;
+                if (effect.load)
+                    result.body.push_back(Node(SET, effect.value + effect.add, it->first));
+                else if ((Cell) effect.add != 0)
+                    result.body.push_back(Node(ADD, effect.add, it->first));
+            }
+            node = result;
+            changed = true;
+        }
+        return changed;
+    }
+    // >(1)+(2)>(1)+(3)<(2) -> +(2)@1+(3)@2
+    //   moves are sunk into the offsets of the nodes after them and only
+    //   applied before a scan, and at the end of a loop body as the net
+    //   move of one iteration, so a loop tests the cell at the offset it is
+    //   entered with and the code after it continues with that offset.
+    //   returns the pending move at the end of block, for a block entered
+    //   with move; loop bodies are left to the caller.
+    int offsets(std::vector<Node> &block, int move) {
+        std::vector<Node> result;
+        result.reserve(block.size());
+        for (size_t i = 0; i < block.size(); ++i) {
+            Node &node = block[i];
+            switch (node.kind) {
+            case SHIFT:
+                move += node.value;
+                continue;
+            case SCAN:
+                // the scan stays in place, the move goes before it
+                if (move != 0)
+                    result.push_back(Node(SHIFT, move));
+                move = 0;
+                break;
+            case LOOP:
+                node.offset = move;
+                break;
+            case LINEAR:
+                node.offset += move;
+                for (size_t j = 0; j < node.body.size(); ++j)
+                    node.body[j].offset += move;
+                break;
+            default:
+                node.offset += move;
+                break;
+            }
+            result.push_back(Node());
+            std::swap(result.back(), node);
+        }
+        block.swap(result);
+        return move;
+    }
+};
+
+template <typename Cell>
+bool fits_short(int n) {
+    return (Cell) (short) n == (Cell) n;
+}
+// insn as the head of the loop node comes from
+Instruction located(Instruction insn, const Node &node) {
+    insn.line = node.line;
+    insn.column = node.column;
+    return insn;
+}
+// a block being lowered, and the OPEN of its loop
+struct LowerFrame {
+    const std::vector<Node> *block;
+    size_t next;
+    int open;
+    LowerFrame(const std::vector<Node> *block, int open) : block(block), next(0), open(open) {
+    }
+};
+// loops are lowered with an explicit stack, deep nesting costs no stack
+template <typename Cell>
+void lower(const std::vector<Node> &program, std::vector<Instruction> &insns) {
+    std::vector<LowerFrame> frames(1, LowerFrame(&program, -1));
+    while (!frames.empty()) {
+        LowerFrame &frame = frames.back();
+        if (frame.next == frame.block->size()) {
+            if (frame.open >= 0) {
+                int diff = insns.size() - frame.open;
+                insns[frame.open].value.i1 = diff;
+                insns.push_back(Instruction(CLOSE, diff + 1, insns[frame.open].offset));
+            }
+            frames.pop_back();
+            continue;
+        }
+        const Node &node = (*frame.block)[frame.next++];
+        switch (node.kind) {
+        case ADD:
+            insns.push_back(Instruction(CALC, node.value, node.offset));
+            break;
+        case SHIFT:
+            insns.push_back(Instruction(MOVE, node.value));
+            break;
+        case SET:
+            insns.push_back(Instruction(LOAD, node.value, node.offset));
+            break;
+        case IN:
+            insns.push_back(Instruction(GET, 0, node.offset));
+            break;
+        case OUT:
+            insns.push_back(Instruction(PUT, 0, node.offset));
+            break;
+        case SCAN:
+            insns.push_back(located(Instruction(SEARCH_ZERO, node.value), node));
+            break;
+        case LOOP:
+            frames.push_back(LowerFrame(&node.body, insns.size()));
+            insns.push_back(located(Instruction(OPEN, 0, node.offset), node));
+            break;
+        case LINEAR: {
+            bool has_set = false;
+            for (size_t j = 0; j < node.body.size(); ++j)
+                has_set |= node.body[j].kind == SET;
+            // the distance is a pointer offset, only the factor wraps at
+            // the cell width
+            if (node.value == 1 && node.body.size() == 1 && !has_set &&
+                    (short) (node.body[0].offset - node.offset) == node.body[0].offset - node.offset &&
+                    fits_short<Cell>(node.body[0].value)) {
+                insns.push_back(located(Instruction(MEM_MOVE,
+                            node.body[0].offset - node.offset, node.body[0].value, node.offset), node));
+                break;
+            }
+            // the final values of set cells only apply when the loop runs,
+            // so then it stays a loop, which exits after one pass
+            int open = insns.size();
+            if (has_set)
+                insns.push_back(Instruction(OPEN, 0, node.offset));
+            insns.push_back(located(Instruction(SET_MULTIPLIER, node.value, node.offset), node));
+            for (size_t j = 0; j < node.body.size(); ++j) {
+                const Node &target = node.body[j];
+                insns.push_back(Instruction(target.kind == SET ? LOAD : CALC_MULT,
+                            target.value, target.offset));
+            }
+            if (has_set) {
+                int diff = insns.size() - open;
+                insns[open].value.i1 = diff;
+                insns.push_back(Instruction(CLOSE, diff + 1, node.offset));
+            }
+            break;
+        }
+        }
+    }
+}
+// frees program one block at a time rather than recursing once per
+// nesting level in the destructors
+void release(std::vector<Node> &program) {
+    std::vector<std::vector<Node> > pending(1);
+    pending.back().swap(program);
+    while (!pending.empty()) {
+        std::vector<Node> block;
+        block.swap(pending.back());
+        pending.pop_back();
+        for (size_t i = 0; i < block.size(); ++i) {
+            if (!block[i].body.empty()) {
+                pending.push_back(std::vector<Node>());
+                pending.back().swap(block[i].body);
+            }
+        }
+    }
+}
+// cells left and right of the first one the prefix may touch; the tape
+// keeps at least a page committed left of its first cell
+#define PREFIX_LEFT 16
+#define PREFIX_CELLS (1 << 24)
+
+// State of a program after its input-independent prefix: the engines
+// write output once, copy cells to the tape at index low and start at
+// instruction pc with the pointer at cell head.
+template <typename Cell>
+struct Snapshot {
+    size_t pc;
+    int head;
+    int low;
+    std::vector<Cell> cells;
+    std::string output;
+    Snapshot() : pc(0), head(0), low(0) {
+    }
+    // pointer to resume with on a tape whose first cell is origin
+    Cell *restore(Cell *origin) const {
+        if (!cells.empty())
+            memcpy(origin + low, &cells[0], cells.size() * sizeof(Cell));
+        return origin + head;
+    }
+};
+// Runs insns from a zeroed tape until the first , or END, until budget
+// instructions ran, or until a cell outside of what the tape is known to
+// hold is touched. Every instruction either runs completely or not at all,
+// a linear loop (X and the x after it) as one, so snapshot always
+// describes the state right before insns[snapshot.pc].
+template <typename Cell>
+bool evaluate_prefix(const std::vector<Instruction> &insns, Snapshot<Cell> &snapshot, long budget) {
+    std::vector<Cell> tape(PREFIX_LEFT);
+    size_t pc = 0;
+    int p = 0;
+    int touched_lo = 0, touched_hi = 0;
+    for (; budget > 0; --budget) {
+        const Instruction &insn = insns[pc];
+        int at = p + insn.offset;
+        // cells [lo, hi) of the instruction must lie on the evaluated tape
+        int lo = at, hi = at + 1;
+        switch (insn.op) {
+        case GET:
+        case END:
+            goto done;
+        case MOVE:
+            lo = hi = 0;
+            break;
+        case CLOSE:
+            lo = hi = 0;
+            break;
+        case SEARCH_ZERO:
+            lo = p;
+            hi = p + 1;
+            break;
+        case MEM_MOVE:
+            if (insn.value.s2.s0 < 0)
+                lo = at + insn.value.s2.s0;
+            else
+                hi = at + insn.value.s2.s0 + 1;
+            break;
+        case SET_MULTIPLIER:
+            for (size_t i = pc + 1; insns[i].op == CALC_MULT || insns[i].op == LOAD; ++i) {
+                int target = p + insns[i].offset;
+                if (target < lo)
+                    lo = target;
+                if (target >= hi)
+                    hi = target + 1;
+            }
+            break;
+        default:
+            break;
+        }
+        if (lo < hi) {
+            if (lo < -PREFIX_LEFT || hi > PREFIX_CELLS)
+                goto done;
+            if ((size_t) (hi + PREFIX_LEFT) > tape.size())
+                tape.resize(hi + PREFIX_LEFT);
+            if (lo < touched_lo)
+                touched_lo = lo;
+            if (hi > touched_hi)
+                touched_hi = hi;
+        }
+        Cell *mem = &tape[PREFIX_LEFT] + p;
+        switch (insn.op) {
+        case PUT:
+            snapshot.output += (char) mem[insn.offset];
+            break;
+        case OPEN:
+            if (mem[insn.offset] == 0)
+                pc += insn.value.i1;
+            break;
+        case CLOSE:
+            pc -= insn.value.i1;
+            break;
+        case CALC:
+            mem[insn.offset] += insn.value.i1;
+            break;
+        case MOVE:
+            p += insn.value.i1;
+            break;
+        case LOAD:
+            mem[insn.offset] = insn.value.i1;
+            break;
+        case SEARCH_ZERO:
+            // one step at a time, the scan resumes where it stopped
+            if (*mem != 0) {
+                p += insn.value.i1;
+                continue;
+            }
+            break;
+        case SET_MULTIPLIER: {
+            Cell mult = mem[insn.offset] * (Cell) insn.value.i1;
+            mem[insn.offset] = 0;
+            for (; insns[pc + 1].op == CALC_MULT || insns[pc + 1].op == LOAD; ++pc) {
+                const Instruction &target = insns[pc + 1];
+                if (target.op == LOAD)
+                    mem[target.offset] = target.value.i1;
+                else
+                    mem[target.offset] += mult * (Cell) target.value.i1;
+            }
+            break;
+        }
+        case MEM_MOVE:
+            mem[insn.offset + insn.value.s2.s0] += mem[insn.offset] * (Cell) insn.value.s2.s1;
+            mem[insn.offset] = 0;
+            break;
+        default:
+            break;
+        }
+        ++pc;
+    }
+done:
+    snapshot.pc = pc;
+    snapshot.head = p;
+    while (touched_lo < touched_hi && tape[touched_lo + PREFIX_LEFT] == 0)
+        ++touched_lo;
+    while (touched_hi > touched_lo && tape[touched_hi - 1 + PREFIX_LEFT] == 0)
+        --touched_hi;
+    snapshot.low = touched_lo;
+    snapshot.cells.assign(tape.begin() + touched_lo + PREFIX_LEFT, tape.begin() + touched_hi + PREFIX_LEFT);
+    return pc != 0;
+}
+// parse, optimize and lower input into insns, and evaluate its prefix
+template <typename Cell>
+void compile(std::vector<Instruction> &insns, Snapshot<Cell> &snapshot,
+        const Source &source, PassManager &passes) {
+    std::vector<Node> program;
+    parse(program, source.begin, source.end);
+    Optimizer<Cell>(passes).optimize(program);
+    lower<Cell>(program, insns);
+    release(program);
+    insns.push_back(Instruction(END));
+    if (passes.enabled[PASS_PREFIX]) {
+        double start = now();
+        bool changed = evaluate_prefix<Cell>(insns, snapshot, passes.budget);
+        passes.record(PASS_PREFIX, start, changed);
+    }
+}
+void debug(std::vector<Instruction> &insns, bool verbose) {
+    for (size_t pc=0;;++pc) {
+        Instruction insn = insns[pc];
+        const char *name = OPCODE_NAMES[insn.op];
+        printf("%s", name);
+        if (verbose && insn.offset != 0) {
+            printf("@%d", insn.offset);
+        }
+        switch(insn.op) {
+            case GET:
+            case PUT:
+            case OPEN:
+            case CLOSE:
+                break;
+            case CALC:
+            case MOVE:
+            case LOAD:
+            case SEARCH_ZERO:
+            case SET_MULTIPLIER:
+            case CALC_MULT:
+                if (verbose) {
+                    printf("(%d)", insn.value.i1);
+                }
+                break;
+            case MEM_MOVE:
+                if (verbose) {
+                    printf("(%d,%d)", insn.value.s2.s0, insn.value.s2.s1);
+                }
+                break;
+            case END:
+                return;
+        }
+    }
+}
+
+#endif
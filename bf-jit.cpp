@@ -1,29 +1,61 @@
 #include <stdio.h>
+#include <string.h>
 #include <stack>
 
 #define MEMSIZE 30000
-#define CODESIZE 50000
 
 #include <xbyak/xbyak.h>
 
+#include "bf-io.h"
+#include "bf-lex.h"
+#include "bf-tape.h"
+
 char* toLabel(char ch, int num) {
     static char labelbuf[BUFSIZ];
     snprintf(labelbuf, sizeof(labelbuf), "%c%d", ch, num);
     return labelbuf;
 }
-void parse(Xbyak::CodeGenerator &gen, FILE *input, int membuf[MEMSIZE]) {
-    gen.push(gen.ebx);
-
+void call(Xbyak::CodeGenerator &gen, const void *func) {
+#ifdef XBYAK64
+    gen.mov(gen.rax, (size_t) func);
+    gen.call(gen.rax);
+#else
+    gen.call(func);
+#endif
+}
+// upper bound of the bytes parse() emits for source
+size_t code_size(const Source &source) {
+    bool vector = __builtin_cpu_supports("sse2");
+    size_t size = 64;
+    for (const char *p = skip_comment(source.begin, source.end, vector); p < source.end;
+            p = skip_comment(p + 1, source.end, vector)) {
+        if (*p != '\n')
+            size += 24;
+    }
+    return size;
+}
+void parse(Xbyak::CodeGenerator &gen, const Source &source, int *membuf, IO *io) {
+#ifdef XBYAK64
+    Xbyak::Reg64 memreg = gen.r12;
+    Xbyak::Reg64 ioreg = gen.r13;
+#else
     Xbyak::Reg32 memreg = gen.ebx;
+    Xbyak::Reg32 ioreg = gen.esi;
+#endif
     Xbyak::Address mem = gen.dword[memreg];
 
-    gen.mov(memreg, (Xbyak::uint32) membuf);
+    gen.push(memreg);
+    gen.push(ioreg);
+#ifdef XBYAK64
+    gen.sub(gen.rsp, 8);
+#endif
+    gen.mov(memreg, (size_t) membuf);
+    gen.mov(ioreg, (size_t) io);
 
     std::stack<int> labelStack;
     int labelNum = 0;
-    int ch;
-    while((ch=getc(input)) != EOF) {
-        switch (ch) {
+    for (const char *p = source.begin; p < source.end; ++p) {
+        switch (*p) {
             case '+':
                 gen.inc(mem);
                 break;
@@ -37,13 +69,27 @@ void parse(Xbyak::CodeGenerator &gen, FILE *input, int membuf[MEMSIZE]) {
                 gen.add(memreg, -4);
                 break;
             case ',':
-                gen.call((void*) getchar);
+#ifdef XBYAK64
+                gen.mov(gen.rdi, ioreg);
+                call(gen, (void*) io_get);
+#else
+                gen.push(ioreg);
+                call(gen, (void*) io_get);
+                gen.pop(gen.ecx);
+#endif
                 gen.mov(mem, gen.eax);
                 break;
             case '.':
+#ifdef XBYAK64
+                gen.mov(gen.rdi, ioreg);
+                gen.mov(gen.esi, mem);
+                call(gen, (void*) io_put);
+#else
                 gen.push(mem);
-                gen.call((void*) putchar);
-                gen.pop(gen.eax);
+                gen.push(ioreg);
+                call(gen, (void*) io_put);
+                gen.add(gen.esp, 8);
+#endif
                 break;
             case '[':
                 gen.L(toLabel('L', labelNum));
@@ -63,17 +109,43 @@ void parse(Xbyak::CodeGenerator &gen, FILE *input, int membuf[MEMSIZE]) {
                 break;
         }
     }
-    gen.pop(gen.ebx);
+#ifdef XBYAK64
+    gen.mov(gen.rdi, ioreg);
+    call(gen, (void*) io_flush);
+    gen.add(gen.rsp, 8);
+#else
+    gen.push(ioreg);
+    call(gen, (void*) io_flush);
+    gen.pop(gen.ecx);
+#endif
+    gen.pop(ioreg);
+    gen.pop(memreg);
     gen.ret();
 }
 void execute(Xbyak::CodeGenerator &gen) {
     void (*codes)() = (void (*)()) gen.getCode();
     codes();
 }
-int main() {
-    static int membuf[MEMSIZE];
-    Xbyak::CodeGenerator gen(CODESIZE);
-    parse(gen, stdin, membuf);
+int main(int argc, char *argv[]) {
+    bool grow_left = false, huge_pages = false;
+    FlushPolicy policy = FLUSH_FULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-grow-left") == 0) {
+            grow_left = true;
+        } else if (strcmp(argv[i], "-huge-pages") == 0) {
+            huge_pages = true;
+        } else if (strcmp(argv[i], "-line-buffered") == 0) {
+            policy = FLUSH_LINE;
+        } else if (strcmp(argv[i], "-unbuffered") == 0) {
+            policy = FLUSH_NONE;
+        }
+    }
+    Source source(stdin);
+    static IO io;
+    io_init(&io, policy);
+    Tape tape(MEMSIZE * sizeof(int), grow_left, huge_pages);
+    Xbyak::CodeGenerator gen(code_size(source));
+    parse(gen, source, (int*) tape.head(), &io);
     execute(gen);
     return 0;
 }
@@ -0,0 +1,112 @@
+#ifndef BF_LEX_H
+#define BF_LEX_H
+
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The program text: the file mapped when input is a regular file, read
+// into memory otherwise. Either way input is left at its end, where the
+// program's own , would have found it after the text was read with getc.
+class Source {
+private:
+    void *map;
+    size_t map_size;
+    std::string text;
+public:
+    const char *begin, *end;
+    Source(FILE *input) : map(NULL), map_size(0) {
+        int fd = fileno(input);
+        struct stat st;
+        off_t from = lseek(fd, 0, SEEK_CUR);
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && from >= 0 && st.st_size > from) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                map = p;
+                map_size = st.st_size;
+                begin = (const char*) p + from;
+                end = (const char*) p + map_size;
+                lseek(fd, 0, SEEK_END);
+                return;
+            }
+        }
+        char buf[BUFSIZ];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), input)) > 0)
+            text.append(buf, n);
+        begin = text.data();
+        end = begin + text.size();
+    }
+    // text the caller keeps for as long as the Source is used
+    Source(const char *begin, const char *end) :
+        map(NULL), map_size(0), begin(begin), end(end) {
+    }
+    ~Source() {
+        if (map != NULL)
+            munmap(map, map_size);
+    }
+    size_t size() const {
+        return end - begin;
+    }
+};
+
+// Bit i set for the bytes of the 16 at p that parse() has to look at:
+// the commands and newlines. Everything else is a comment.
+__attribute__((target("sse2")))
+inline uint32_t lexeme_bytes(const char *p) {
+    __m128i v = _mm_loadu_si128((const __m128i*) p);
+    // + , - . are 0x2b to 0x2e
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('+'));
+    __m128i bits = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(3)), d);
+    bits = _mm_or_si128(bits, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    bits = _mm_or_si128(bits, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    bits = _mm_or_si128(bits, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+    bits = _mm_or_si128(bits, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+    bits = _mm_or_si128(bits, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    return _mm_movemask_epi8(bits);
+}
+inline bool is_lexeme(char ch) {
+    switch (ch) {
+        case '+': case '-': case '>': case '<': case ',': case '.': case '[': case ']': case '\n':
+            return true;
+        default:
+            return false;
+    }
+}
+// first byte from p on parse() has to look at, or end
+inline const char *skip_comment(const char *p, const char *end, bool vector) {
+    if (vector) {
+        for (; end - p >= 16; p += 16) {
+            if (uint32_t bits = lexeme_bytes(p))
+                return p + __builtin_ctz(bits);
+        }
+    }
+    while (p < end && !is_lexeme(*p))
+        ++p;
+    return p;
+}
+// the first byte from p on that is not ch, or where fewer than 16 are left
+__attribute__((target("sse2")))
+inline const char *skip_run_sse2(const char *p, const char *end, char ch) {
+    __m128i v = _mm_set1_epi8(ch);
+    for (; end - p >= 16; p += 16) {
+        uint32_t other = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), v)) & 0xffff;
+        if (other != 0)
+            return p + __builtin_ctz(other);
+    }
+    return p;
+}
+// bytes from p on that are *p
+inline size_t run_length(const char *p, const char *end, bool vector) {
+    const char *q = vector ? skip_run_sse2(p, end, *p) : p;
+    while (q < end && *q == *p)
+        ++q;
+    return q - p;
+}
+
+#endif
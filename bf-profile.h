@@ -0,0 +1,69 @@
+#ifndef BF_PROFILE_H
+#define BF_PROFILE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "bf-ir.h"
+
+// -profile counters of the loop whose head is the instruction at the same
+// index. Fused loops (s(n), M, X) count the iterations the source loop
+// would have run; the cycles are the TSC ticks spent in generic loops and
+// scans, inner loops included.
+struct LoopProfile {
+    uint64_t entries, iterations, cycles;
+    // TSC and pointer when the loop was entered, while it runs
+    uint64_t start;
+    uintptr_t from;
+    LoopProfile() : entries(0), iterations(0), cycles(0), start(0), from(0) {
+    }
+};
+const char *loop_form(Opcode op) {
+    switch (op) {
+        case SEARCH_ZERO:
+            return "SEARCH_ZERO";
+        case MEM_MOVE:
+            return "MEM_MOVE";
+        case SET_MULTIPLIER:
+            return "multiplier";
+        default:
+            return "generic";
+    }
+}
+// most expensive first
+class ProfileOrder {
+private:
+    const std::vector<LoopProfile> &profile;
+public:
+    ProfileOrder(const std::vector<LoopProfile> &profile) : profile(profile) {
+    }
+    bool operator()(size_t a, size_t b) const {
+        if (profile[a].cycles != profile[b].cycles)
+            return profile[a].cycles > profile[b].cycles;
+        return profile[a].iterations > profile[b].iterations;
+    }
+};
+void report_profile(const std::vector<Instruction> &insns,
+        const std::vector<LoopProfile> &profile, FILE *out) {
+    std::vector<size_t> loops;
+    for (size_t pc = 0; pc < insns.size(); ++pc) {
+        if (insns[pc].line != 0 && profile[pc].entries != 0)
+            loops.push_back(pc);
+    }
+    std::stable_sort(loops.begin(), loops.end(), ProfileOrder(profile));
+    fprintf(out, "%-10s %-12s %12s %16s %16s\n", "line:col", "form", "entries", "iterations", "cycles");
+    for (size_t i = 0; i < loops.size(); ++i) {
+        const Instruction &insn = insns[loops[i]];
+        const LoopProfile &loop = profile[loops[i]];
+        char position[32];
+        snprintf(position, sizeof(position), "%d:%d", insn.line, insn.column);
+        fprintf(out, "%-10s %-12s %12llu %16llu %16llu\n", position, loop_form(insn.op),
+                (unsigned long long) loop.entries, (unsigned long long) loop.iterations,
+                (unsigned long long) loop.cycles);
+    }
+}
+
+#endif
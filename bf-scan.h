@@ -0,0 +1,115 @@
+#ifndef BF_SCAN_H
+#define BF_SCAN_H
+
+#include <cstdlib>
+#include <stdint.h>
+#include <immintrin.h>
+
+// Kernels for SEARCH_ZERO: return the first cell at p + k * stride (k >= 0)
+// that is zero.
+// The vector kernels compare a whole aligned block of the tape and keep
+// only the lanes that lie on the stride, so they need the stride in bytes
+// to be a power of two no larger than a block. Aligned loads never cross
+// a page, so they only touch pages the scalar loop would touch as well.
+typedef void *(*ScanFunc)(void *p, int stride);
+
+template <typename Cell>
+void *scan_scalar(void *p, int stride) {
+    Cell *mem = (Cell*) p;
+    while (*mem != 0)
+        mem += stride;
+    return mem;
+}
+// bit i set for the bytes of a block that start a cell on the stride
+inline uint32_t stride_mask(unsigned span, unsigned phase) {
+    static const uint32_t PATTERNS[] = {
+        0xffffffff, 0x55555555, 0x11111111, 0x01010101, 0x00010001, 0x00000001
+    };
+    return PATTERNS[__builtin_ctz(span)] << (phase & (span - 1));
+}
+template <typename Cell>
+__attribute__((target("sse2")))
+uint32_t zero_bytes(__m128i v) {
+    __m128i zero = _mm_setzero_si128();
+    switch (sizeof(Cell)) {
+        case 1:
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        case 2:
+            return _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+        default:
+            return _mm_movemask_epi8(_mm_cmpeq_epi32(v, zero));
+    }
+}
+template <typename Cell>
+__attribute__((target("avx2")))
+uint32_t zero_bytes(__m256i v) {
+    __m256i zero = _mm256_setzero_si256();
+    switch (sizeof(Cell)) {
+        case 1:
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+        case 2:
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, zero));
+        default:
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, zero));
+    }
+}
+template <typename Cell>
+__attribute__((target("sse2")))
+void *scan_sse2(void *p, int stride) {
+    const unsigned BLOCK = 16;
+    if (*(Cell*) p == 0)
+        return p;
+    unsigned span = std::abs(stride) * sizeof(Cell);
+    unsigned first = (uintptr_t) p % BLOCK;
+    const __m128i *block = (const __m128i*) ((uintptr_t) p - first);
+    uint32_t mask = stride_mask(span, first);
+    uint32_t bits;
+    if (stride > 0) {
+        bits = zero_bytes<Cell>(_mm_load_si128(block)) & mask & (~0u << first);
+        while (bits == 0)
+            bits = zero_bytes<Cell>(_mm_load_si128(++block)) & mask;
+        return (char*) block + __builtin_ctz(bits);
+    } else {
+        bits = zero_bytes<Cell>(_mm_load_si128(block)) & mask & ((2u << first) - 1);
+        while (bits == 0)
+            bits = zero_bytes<Cell>(_mm_load_si128(--block)) & mask;
+        return (char*) block + 31 - __builtin_clz(bits);
+    }
+}
+template <typename Cell>
+__attribute__((target("avx2")))
+void *scan_avx2(void *p, int stride) {
+    const unsigned BLOCK = 32;
+    if (*(Cell*) p == 0)
+        return p;
+    unsigned span = std::abs(stride) * sizeof(Cell);
+    unsigned first = (uintptr_t) p % BLOCK;
+    const __m256i *block = (const __m256i*) ((uintptr_t) p - first);
+    uint32_t mask = stride_mask(span, first);
+    uint32_t bits;
+    if (stride > 0) {
+        bits = zero_bytes<Cell>(_mm256_load_si256(block)) & mask & (~0u << first);
+        while (bits == 0)
+            bits = zero_bytes<Cell>(_mm256_load_si256(++block)) & mask;
+        return (char*) block + __builtin_ctz(bits);
+    } else {
+        bits = zero_bytes<Cell>(_mm256_load_si256(block)) & mask & ((2u << first) - 1);
+        while (bits == 0)
+            bits = zero_bytes<Cell>(_mm256_load_si256(--block)) & mask;
+        return (char*) block + 31 - __builtin_clz(bits);
+    }
+}
+// best vector kernel of this CPU for stride, NULL if only scan_scalar fits
+template <typename Cell>
+ScanFunc select_scan(int stride) {
+    unsigned span = std::abs(stride) * sizeof(Cell);
+    if (span == 0 || (span & (span - 1)) != 0)
+        return NULL;
+    if (span <= 32 && __builtin_cpu_supports("avx2"))
+        return scan_avx2<Cell>;
+    if (span <= 16 && __builtin_cpu_supports("sse2"))
+        return scan_sse2<Cell>;
+    return NULL;
+}
+
+#endif
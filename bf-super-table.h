@@ -0,0 +1,132 @@
+// generated by bench/super-gen (make superinstructions), do not edit
+//
+// dispatches without and with these superinstructions
+// on the held-out programs, not trained on:
+//   sample/mandelbrot-titannic.b    39031002085 ->    22169331007  (-43.2%)
+// on the training programs, which the table is fitted to:
+//   sample/hello.bf                           1 ->              1  (-0.0%)
+//   sample/long.b                     675037768 ->      378896171  (-43.9%)
+//   sample/mandelbrot.b              1479270143 ->      840285303  (-43.2%)
+#ifndef BF_SUPER_TABLE_H
+#define BF_SUPER_TABLE_H
+
+#include "bf-super.h"
+
+#define SUPER_COUNT 16
+const Superinstruction SUPERINSTRUCTIONS[] = {
+    { 4, { OPEN, MEM_MOVE, MOVE, CLOSE } },
+    { 4, { OPEN, OPEN, CALC, CALC } },
+    { 4, { CALC, MEM_MOVE, LOAD, CLOSE } },
+    { 3, { CALC, OPEN, CALC } },
+    { 4, { MEM_MOVE, SET_MULTIPLIER, CALC_MULT, CALC_MULT } },
+    { 3, { CALC, MOVE, CLOSE } },
+    { 4, { CALC, SET_MULTIPLIER, CALC_MULT, CALC_MULT } },
+    { 2, { MOVE, CLOSE } },
+    { 4, { OPEN, CALC, MEM_MOVE, OPEN } },
+    { 3, { LOAD, LOAD, LOAD } },
+    { 2, { MOVE, SEARCH_ZERO } },
+    { 4, { MEM_MOVE, CALC, MOVE, CLOSE } },
+    { 2, { MEM_MOVE, CLOSE } },
+    { 4, { OPEN, MOVE, SEARCH_ZERO, CALC } },
+    { 2, { OPEN, LOAD } },
+    { 4, { MOVE, SEARCH_ZERO, OPEN, MEM_MOVE } },
+};
+#define SUPER_LABELS \
+    &&LABEL_SUPER_0, \
+    &&LABEL_SUPER_1, \
+    &&LABEL_SUPER_2, \
+    &&LABEL_SUPER_3, \
+    &&LABEL_SUPER_4, \
+    &&LABEL_SUPER_5, \
+    &&LABEL_SUPER_6, \
+    &&LABEL_SUPER_7, \
+    &&LABEL_SUPER_8, \
+    &&LABEL_SUPER_9, \
+    &&LABEL_SUPER_10, \
+    &&LABEL_SUPER_11, \
+    &&LABEL_SUPER_12, \
+    &&LABEL_SUPER_13, \
+    &&LABEL_SUPER_14, \
+    &&LABEL_SUPER_15
+#define SUPER_HANDLERS \
+LABEL_SUPER_0: \
+    SUPER_OPEN \
+    SUPER_MEM_MOVE \
+    SUPER_MOVE \
+    SUPER_CLOSE \
+LABEL_SUPER_1: \
+    SUPER_OPEN \
+    SUPER_OPEN \
+    SUPER_CALC \
+    SUPER_CALC \
+    SUPER_NEXT \
+LABEL_SUPER_2: \
+    SUPER_CALC \
+    SUPER_MEM_MOVE \
+    SUPER_LOAD \
+    SUPER_CLOSE \
+LABEL_SUPER_3: \
+    SUPER_CALC \
+    SUPER_OPEN \
+    SUPER_CALC \
+    SUPER_NEXT \
+LABEL_SUPER_4: \
+    SUPER_MEM_MOVE \
+    SUPER_SET_MULTIPLIER \
+    SUPER_CALC_MULT \
+    SUPER_CALC_MULT \
+    SUPER_NEXT \
+LABEL_SUPER_5: \
+    SUPER_CALC \
+    SUPER_MOVE \
+    SUPER_CLOSE \
+LABEL_SUPER_6: \
+    SUPER_CALC \
+    SUPER_SET_MULTIPLIER \
+    SUPER_CALC_MULT \
+    SUPER_CALC_MULT \
+    SUPER_NEXT \
+LABEL_SUPER_7: \
+    SUPER_MOVE \
+    SUPER_CLOSE \
+LABEL_SUPER_8: \
+    SUPER_OPEN \
+    SUPER_CALC \
+    SUPER_MEM_MOVE \
+    SUPER_OPEN \
+    SUPER_NEXT \
+LABEL_SUPER_9: \
+    SUPER_LOAD \
+    SUPER_LOAD \
+    SUPER_LOAD \
+    SUPER_NEXT \
+LABEL_SUPER_10: \
+    SUPER_MOVE \
+    SUPER_SEARCH_ZERO \
+    SUPER_NEXT \
+LABEL_SUPER_11: \
+    SUPER_MEM_MOVE \
+    SUPER_CALC \
+    SUPER_MOVE \
+    SUPER_CLOSE \
+LABEL_SUPER_12: \
+    SUPER_MEM_MOVE \
+    SUPER_CLOSE \
+LABEL_SUPER_13: \
+    SUPER_OPEN \
+    SUPER_MOVE \
+    SUPER_SEARCH_ZERO \
+    SUPER_CALC \
+    SUPER_NEXT \
+LABEL_SUPER_14: \
+    SUPER_OPEN \
+    SUPER_LOAD \
+    SUPER_NEXT \
+LABEL_SUPER_15: \
+    SUPER_MOVE \
+    SUPER_SEARCH_ZERO \
+    SUPER_OPEN \
+    SUPER_MEM_MOVE \
+    SUPER_NEXT
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef BF_SUPER_H
+#define BF_SUPER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "bf-ir.h"
+
+// Superinstructions of the VM: sequences of up to SUPER_MAX instructions
+// that execute() runs from one handler, with one dispatch instead of one
+// per instruction. They are made of any instructions but END and CLOSE,
+// and may end with a CLOSE; an OPEN leaves the sequence when its cell is
+// zero. Every instruction keeps its own record (bf-vm.h), only the
+// first one of a sequence dispatches to the fused handler, so jumps into
+// the middle of a sequence run the single handlers.
+//
+// Which sequences there are is trained: bench/super-gen runs sample
+// programs, counts how often every sequence of instructions ran and
+// writes bf-super-table.h, the table and the handlers of the sequences
+// that save the most dispatches (make superinstructions).
+#define SUPER_MAX 4
+
+struct Superinstruction {
+    int length;
+    Opcode ops[SUPER_MAX];
+};
+// whether op may be at position i of a sequence of length n
+inline bool fusable(Opcode op, int i, int n) {
+    return op != END && (op != CLOSE || i == n - 1);
+}
+// the longest of table[0..count) that insns[pc..] starts with, the first
+// one of those with a tie, or -1
+inline int match_super(const std::vector<Instruction> &insns, size_t pc,
+        const Superinstruction *table, int count) {
+    int best = -1;
+    for (int s = 0; s < count; ++s) {
+        const Superinstruction &super = table[s];
+        if (best >= 0 && super.length <= table[best].length)
+            continue;
+        if (pc + super.length > insns.size())
+            continue;
+        int i = 0;
+        while (i < super.length && insns[pc + i].op == super.ops[i])
+            ++i;
+        if (i == super.length)
+            best = s;
+    }
+    return best;
+}
+// index + 1 of the superinstruction starting at every pc, 0 where none
+// does; sequences do not overlap, the first match from the left wins
+inline void assign_supers(const std::vector<Instruction> &insns,
+        const Superinstruction *table, int count, std::vector<int> &starts) {
+    starts.assign(insns.size(), 0);
+    for (size_t pc = 0; pc < insns.size();) {
+        int super = match_super(insns, pc, table, count);
+        if (super < 0) {
+            ++pc;
+            continue;
+        }
+        starts[pc] = super + 1;
+        pc += table[super].length;
+    }
+}
+
+#endif
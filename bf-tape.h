@@ -0,0 +1,140 @@
+#ifndef BF_TAPE_H
+#define BF_TAPE_H
+
+#include <csignal>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// virtual address space reserved for one tape, guard regions included
+#define TAPE_RESERVE (sizeof(void*) == 8 ? (size_t) 1 << 34 : (size_t) 1 << 28)
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+// committed bytes Tape::clear() zeroes itself
+#define TAPE_CLEAR_LIMIT ((size_t) 1 << 20)
+
+// The tape is a PROT_NONE reservation of which only [lo, hi) is readable.
+// Touching the reservation outside of it faults, and the SIGSEGV handler
+// commits more pages and restarts the faulting instruction, so engines
+// never have to check bounds themselves.
+// The first and last chunk of the reservation are never committed.
+// One chunk left of the origin is committed up front: optimized loops may
+// add zero to cells they would never have visited.
+class Tape {
+private:
+    char *mapping;
+    char *base;
+    size_t size;
+    size_t chunk;
+    char *lo, *hi;
+    char *origin;
+    bool grow_left;
+    // the tape of the run on this thread; SIGSEGV is delivered to the
+    // thread that faulted, so runs on other threads keep their own
+    static __thread Tape *active;
+    static struct sigaction previous;
+    static void report(const char *message) {
+        ssize_t ret = write(STDERR_FILENO, message, strlen(message));
+        (void) ret;
+    }
+    size_t round_up(size_t n) const {
+        return (n + chunk - 1) / chunk * chunk;
+    }
+    bool commit(char *from, char *to) {
+        return mprotect(from, to - from, PROT_READ | PROT_WRITE) == 0;
+    }
+    bool grow(char *addr) {
+        char *limit_lo = base + chunk, *limit_hi = base + size - chunk;
+        if (addr >= hi && addr < limit_hi) {
+            // at least double, like std::vector
+            size_t step = round_up(addr + 1 - hi);
+            if (step < (size_t) (hi - lo))
+                step = hi - lo;
+            char *to = step < (size_t) (limit_hi - hi) ? hi + step : limit_hi;
+            if (!commit(hi, to))
+                return false;
+            hi = to;
+            return true;
+        }
+        if (grow_left && addr < lo && addr >= limit_lo) {
+            size_t step = round_up(lo - addr);
+            if (step < (size_t) (hi - lo))
+                step = hi - lo;
+            char *from = step < (size_t) (lo - limit_lo) ? lo - step : limit_lo;
+            if (!commit(from, lo))
+                return false;
+            lo = from;
+            return true;
+        }
+        return false;
+    }
+    static void on_segv(int, siginfo_t *info, void *) {
+        char *addr = (char*) info->si_addr;
+        if (active != NULL && active->grow(addr))
+            return;
+        if (active != NULL && addr >= active->base && addr < active->base + active->size)
+            report(addr < active->origin ? "tape underflow\n" : "tape overflow\n");
+        // let the access fault again with the action from before the
+        // first tape
+        sigaction(SIGSEGV, &previous, NULL);
+    }
+    static bool install() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = on_segv;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGSEGV, &action, &previous) == 0;
+    }
+public:
+    Tape(size_t initial, bool grow_left, bool huge_pages) :
+        grow_left(grow_left) {
+        if (active != NULL)
+            throw "one tape per thread";
+        chunk = huge_pages ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+        // settle for less address space under RLIMIT_AS
+        for (size = TAPE_RESERVE; ; size /= 2) {
+            if (size < 4 * chunk + round_up(initial))
+                throw "tape reservation failed";
+            mapping = (char*) mmap(NULL, size + chunk, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mapping != MAP_FAILED)
+                break;
+        }
+        // huge pages are only used for huge-page aligned ranges
+        base = (char*) round_up((size_t) mapping);
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
+            madvise(base, size, MADV_HUGEPAGE);
+#endif
+        origin = grow_left ? base + round_up(size / 2) : base + 2 * chunk;
+        lo = origin - chunk;
+        hi = origin + round_up(initial);
+        if (!commit(lo, hi))
+            throw "tape commit failed";
+
+        active = this;
+        // once, and left installed for the tapes of other threads
+        static bool installed = install();
+        (void) installed;
+    }
+    ~Tape() {
+        active = NULL;
+        munmap(mapping, size + chunk);
+    }
+    void *head() const {
+        return origin;
+    }
+    // zeroes the tape for the next run, keeping what is committed. Large
+    // tapes get zero pages from the kernel again, small ones are cleared
+    // in place: dropping pages costs TLB shootdowns on every thread.
+    void clear() {
+        if ((size_t) (hi - lo) <= TAPE_CLEAR_LIMIT)
+            memset(lo, 0, hi - lo);
+        else
+            madvise(lo, hi - lo, MADV_DONTNEED);
+    }
+};
+__thread Tape *Tape::active = NULL;
+struct sigaction Tape::previous;
+
+#endif
@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#include <xbyak/xbyak.h>
+
+#include "bf-codegen.h"
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-lex.h"
+#include "bf-tape.h"
+#include "bf-vm.h"
+
+#define MEMSIZE 30000
+#define TIER_THRESHOLD 1000
+
+// compiles the loops execute() finds hot, each into its own code buffer
+template <typename Cell>
+class Tier : public LoopCompiler {
+private:
+    std::vector<Instruction> &insns;
+    IO *io;
+    std::vector<Xbyak::CodeGenerator*> codes;
+public:
+    size_t loops, bytes;
+    double time;
+    Tier(std::vector<Instruction> &insns, IO *io, unsigned threshold) :
+        LoopCompiler(threshold), insns(insns), io(io), loops(0), bytes(0), time(0) {
+    }
+    ~Tier() {
+        for (size_t i = 0; i < codes.size(); ++i)
+            delete codes[i];
+    }
+    NativeLoop compile(size_t open) {
+        double start = now();
+        size_t size = code_size(insns, open, open + insns[open].value.i1);
+        Xbyak::CodeGenerator *gen = new Xbyak::CodeGenerator(size);
+        codes.push_back(gen);
+        Jit<Cell>(*gen, insns, io).loop(open);
+        ++loops;
+        bytes += gen->getSize();
+        time += now() - start;
+        return (NativeLoop) gen->getCode();
+    }
+};
+struct Options {
+    const char *mode;
+    int cell_bits;
+    bool grow_left, huge_pages, stats;
+    unsigned threshold;
+    FlushPolicy policy;
+    PassManager passes;
+};
+template <typename Cell>
+void run(FILE *input, Options &options) {
+    std::vector<Instruction> insns;
+    Snapshot<Cell> snapshot;
+    double compile_start = now();
+    compile<Cell>(insns, snapshot, Source(input), options.passes);
+    double compile_end = now();
+    if (options.passes.timing)
+        options.passes.report(stderr);
+    if (options.mode == NULL) {
+        static IO io;
+        io_init(&io, options.policy);
+        Tape tape(MEMSIZE * sizeof(Cell), options.grow_left, options.huge_pages);
+        Cell *head = snapshot.restore((Cell*) tape.head());
+        Tier<Cell> tier(insns, &io, options.threshold);
+        io_write(&io, snapshot.output.data(), snapshot.output.size());
+        execute<Cell>(insns, snapshot.pc, head, &io, &tier);
+        if (options.stats) {
+            fprintf(stderr, "compile: %.3f ms, jit: %.3f ms, loops: %zu, code: %zu bytes\n",
+                    compile_end - compile_start, tier.time, tier.loops, tier.bytes);
+        }
+    } else if (strcmp(options.mode, "-debug") == 0) {
+        debug(insns, false);
+    } else if (strcmp(options.mode, "-debug-verbose") == 0) {
+        debug(insns, true);
+    }
+}
+int main(int argc, char *argv[]) {
+    if(argc == 1) {
+        printf("usage: $0 <file>(- for stdin) [-cell8|-cell16|-cell32] [-grow-left] [-huge-pages] [-line-buffered|-unbuffered] [-threshold=<n>] [-stats] [-time-passes] [-no-<pass>] [-prefix-budget=<n>] [-debug[-verbose]]\n");
+        return 0;
+    }
+    Options options;
+    options.mode = NULL;
+    options.cell_bits = 32;
+    options.grow_left = options.huge_pages = options.stats = false;
+    options.threshold = TIER_THRESHOLD;
+    options.policy = FLUSH_FULL;
+    for (int i = 2; i < argc; ++i) {
+        const char *option = argv[i];
+        if (options.passes.parse_option(option)) {
+            continue;
+        } else if (strncmp(option, "-threshold=", 11) == 0) {
+            options.threshold = atoi(option + 11);
+        } else if (strcmp(option, "-grow-left") == 0) {
+            options.grow_left = true;
+        } else if (strcmp(option, "-huge-pages") == 0) {
+            options.huge_pages = true;
+        } else if (strcmp(option, "-line-buffered") == 0) {
+            options.policy = FLUSH_LINE;
+        } else if (strcmp(option, "-unbuffered") == 0) {
+            options.policy = FLUSH_NONE;
+        } else if (strcmp(option, "-stats") == 0) {
+            options.stats = true;
+        } else if (strcmp(option, "-cell8") == 0) {
+            options.cell_bits = 8;
+        } else if (strcmp(option, "-cell16") == 0) {
+            options.cell_bits = 16;
+        } else if (strcmp(option, "-cell32") == 0) {
+            options.cell_bits = 32;
+        } else {
+            options.mode = option;
+        }
+    }
+    FILE *input = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    switch (options.cell_bits) {
+        case 8:
+            run<uint8_t>(input, options);
+            break;
+        case 16:
+            run<uint16_t>(input, options);
+            break;
+        default:
+            run<uint32_t>(input, options);
+            break;
+    }
+    if (input != stdin)
+        fclose(input);
+    return 0;
+}
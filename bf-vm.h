@@ -0,0 +1,521 @@
+#ifndef BF_VM_H
+#define BF_VM_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#include <stdint.h>
+
+#include "bf-io.h"
+#include "bf-ir.h"
+#include "bf-profile.h"
+#include "bf-scan.h"
+#include "bf-super-table.h"
+
+// native code for the loop at an OPEN: runs it to its end and returns the
+// pointer after it
+typedef void *(*NativeLoop)(void *mem);
+// gets loops whose back edge ran threshold times, returns NULL to keep
+// interpreting them
+class LoopCompiler {
+public:
+    unsigned threshold;
+    LoopCompiler(unsigned threshold) : threshold(threshold) {
+    }
+    virtual ~LoopCompiler() {
+    }
+    virtual NativeLoop compile(size_t open) = 0;
+};
+// The bytecode execute() runs: a record of 32-bit words per instruction,
+// one after the other in a cache line aligned arena, whose first word is
+// the offset of the handler from LABEL_END. The operands follow in as few
+// words as the instruction needs:
+//
+//   END
+//   GET PUT                      offset
+//   MOVE                         value
+//   CALC LOAD                    offset:16 value:16
+//   SET_MULTIPLIER CALC_MULT     offset:16 value:16
+//   MEM_MOVE                     offset, s0:16 s1:16
+//   SEARCH_ZERO                  stride, 1 where scan handles it
+//   OPEN                         offset, target (the record after the CLOSE)
+//   CLOSE                        target (the OPEN)
+//
+// CALC, LOAD, SET_MULTIPLIER and CALC_MULT whose offset or value does not
+// fit in 16 bits take a word for each (the _WIDE handlers), and so does
+// every profiled SET_MULTIPLIER. Targets are pointers into the arena, in
+// two words on x86-64.
+typedef int32_t Word;
+// a pointer stored in words, which are only 4-byte aligned
+typedef Word *Target __attribute__((aligned(4)));
+#define TARGET_WORDS (sizeof(void*) / sizeof(Word))
+#define OFFSET16(w) ((w) >> 16)
+#define VALUE16(w) ((short) (w))
+
+template <typename Cell>
+bool packs(const Instruction &insn, bool profiled) {
+    switch (insn.op) {
+        case SET_MULTIPLIER:
+            if (profiled)
+                return false;
+            // fall through
+        case CALC:
+        case LOAD:
+        case CALC_MULT:
+            return (short) insn.offset == insn.offset && fits_short<Cell>(insn.value.i1);
+        default:
+            return true;
+    }
+}
+template <typename Cell>
+size_t record_words(const Instruction &insn, bool profiled) {
+    switch (insn.op) {
+        case END:
+            return 1;
+        case GET:
+        case PUT:
+        case MOVE:
+            return 2;
+        case CALC:
+        case LOAD:
+        case SET_MULTIPLIER:
+        case CALC_MULT:
+            return packs<Cell>(insn, profiled) ? 2 : 3;
+        case MEM_MOVE:
+        case SEARCH_ZERO:
+            return 3;
+        case OPEN:
+            return 2 + TARGET_WORDS;
+        case CLOSE:
+            return 1 + TARGET_WORDS;
+    }
+    return 1;
+}
+// words aligned to a cache line, freed with the arena
+class Arena {
+private:
+    Word *words;
+    Arena(const Arena&);
+    Arena &operator=(const Arena&);
+public:
+    Arena(size_t n) {
+        void *p;
+        if (posix_memalign(&p, 64, n * sizeof(Word)) != 0)
+            throw "bytecode allocation failed";
+        words = (Word*) p;
+    }
+    ~Arena() {
+        free(words);
+    }
+    Word *get() const {
+        return words;
+    }
+};
+// what word 0 of a record holds until a dispatcher turns it into its own
+// form. The other dispatchers (bf-dispatch.h) run the handlers up to
+// H_END only, the ones after it count and profile for execute().
+enum Handler {
+    H_GET, H_PUT, H_OPEN, H_CLOSE, H_CALC, H_CALC_WIDE, H_MOVE, H_LOAD, H_LOAD_WIDE,
+    H_MEM_MOVE, H_SEARCH_ZERO, H_SCAN, H_SET_MULTIPLIER, H_SET_MULTIPLIER_WIDE,
+    H_CALC_MULT, H_CALC_MULT_WIDE, H_END,
+    H_CLOSE_COUNT, H_OPEN_PROFILE, H_CLOSE_PROFILE, H_MEM_MOVE_PROFILE,
+    H_SET_MULTIPLIER_PROFILE, H_SEARCH_ZERO_PROFILE, H_SCAN_PROFILE,
+    HANDLERS
+};
+#define PLAIN_HANDLERS (H_END + 1)
+
+// insns as records in an arena; with count, the CLOSEs count the back
+// edges of their loops, with profile the loops that have a line in it
+// get handlers that count into it
+template <typename Cell>
+class Bytecode {
+private:
+    static size_t size(const std::vector<Instruction> &insns, LoopProfile *profile) {
+        size_t words = 0;
+        for (size_t pc = 0; pc < insns.size(); ++pc)
+            words += record_words<Cell>(insns[pc], profile != NULL && insns[pc].line != 0);
+        return words;
+    }
+    Arena arena;
+public:
+    Word *code;
+    // the record of every instruction, in words from the first
+    std::vector<size_t> at;
+    // the instruction of every record, with count or profile only
+    std::vector<size_t> index;
+    // every kernel select_scan() returns handles every stride it accepts
+    ScanFunc scan;
+    // word 0 of every record is its handler offset, after the first run
+    bool threaded;
+    Bytecode(const std::vector<Instruction> &insns, bool count, LoopProfile *profile) :
+        arena(size(insns, profile)), code(arena.get()), at(insns.size()),
+        index(count || profile != NULL ? size(insns, profile) : 0), scan(NULL), threaded(false) {
+        size_t words = 0;
+        for (size_t pc = 0; pc < insns.size(); ++pc) {
+            at[pc] = words;
+            words += record_words<Cell>(insns[pc], profile != NULL && insns[pc].line != 0);
+        }
+        for (size_t pc = 0; pc < insns.size(); ++pc)
+            encode(insns, pc, count, profile);
+    }
+private:
+    void encode(const std::vector<Instruction> &insns, size_t pc, bool count, LoopProfile *profile) {
+        const Instruction &insn = insns[pc];
+        bool profiled = profile != NULL && insn.line != 0;
+        bool packed = packs<Cell>(insn, profiled);
+        Word *record = code + at[pc];
+        Handler handler = H_END;
+        if (!index.empty())
+            index[at[pc]] = pc;
+        switch(insn.op) {
+            case GET:
+                handler = H_GET;
+                record[1] = insn.offset;
+                break;
+            case PUT:
+                handler = H_PUT;
+                record[1] = insn.offset;
+                break;
+            case OPEN:
+                handler = profiled ? H_OPEN_PROFILE : H_OPEN;
+                record[1] = insn.offset;
+                *(Target*) (record + 2) = code + at[pc + insn.value.i1 + 1];
+                break;
+            case CLOSE:
+                if (profile != NULL && insns[pc - insn.value.i1 + 1].line != 0)
+                    handler = H_CLOSE_PROFILE;
+                else
+                    handler = count ? H_CLOSE_COUNT : H_CLOSE;
+                *(Target*) (record + 1) = code + at[pc - insn.value.i1 + 1];
+                break;
+            case CALC:
+                handler = packed ? H_CALC : H_CALC_WIDE;
+                break;
+            case MOVE:
+                handler = H_MOVE;
+                record[1] = insn.value.i1;
+                break;
+            case LOAD:
+                handler = packed ? H_LOAD : H_LOAD_WIDE;
+                break;
+            case MEM_MOVE:
+                handler = profiled ? H_MEM_MOVE_PROFILE : H_MEM_MOVE;
+                record[1] = insn.offset;
+                record[2] = (Word) ((uint32_t) (uint16_t) insn.value.s2.s0 << 16 | (uint16_t) insn.value.s2.s1);
+                break;
+            case SEARCH_ZERO:
+                record[1] = insn.value.i1;
+                record[2] = 0;
+                if (ScanFunc found = select_scan<Cell>(insn.value.i1)) {
+                    scan = found;
+                    record[2] = 1;
+                    handler = profiled ? H_SCAN_PROFILE : H_SCAN;
+                } else {
+                    handler = profiled ? H_SEARCH_ZERO_PROFILE : H_SEARCH_ZERO;
+                }
+                break;
+            case SET_MULTIPLIER:
+                if (profiled)
+                    handler = H_SET_MULTIPLIER_PROFILE;
+                else
+                    handler = packed ? H_SET_MULTIPLIER : H_SET_MULTIPLIER_WIDE;
+                break;
+            case CALC_MULT:
+                handler = packed ? H_CALC_MULT : H_CALC_MULT_WIDE;
+                break;
+            case END:
+                handler = H_END;
+                break;
+        }
+        switch (insn.op) {
+            case CALC:
+            case LOAD:
+            case SET_MULTIPLIER:
+            case CALC_MULT:
+                if (packed) {
+                    record[1] = (Word) ((uint32_t) insn.offset << 16 | (uint16_t) insn.value.i1);
+                } else {
+                    record[1] = insn.offset;
+                    record[2] = insn.value.i1;
+                }
+                break;
+            default:
+                break;
+        }
+        record[0] = handler;
+    }
+};
+// the instructions of a superinstruction (bf-super.h), each reads its
+// record at pc and moves pc to the next one; the records are packed
+#define SUPER_GET \
+    mem[pc[1]] = io_get(io); \
+    pc += 2;
+#define SUPER_PUT \
+    io_put(io, mem[pc[1]]); \
+    pc += 2;
+#define SUPER_OPEN \
+    if (mem[pc[1]] == 0) { \
+        pc = *(Target*) (pc + 2); \
+        NEXT_LABEL; \
+    } \
+    pc += 2 + TARGET_WORDS;
+#define SUPER_CLOSE \
+    pc = *(Target*) (pc + 1); \
+    NEXT_LABEL;
+#define SUPER_CALC \
+    mem[OFFSET16(pc[1])] += VALUE16(pc[1]); \
+    pc += 2;
+#define SUPER_MOVE \
+    mem += pc[1]; \
+    pc += 2;
+#define SUPER_LOAD \
+    mem[OFFSET16(pc[1])] = VALUE16(pc[1]); \
+    pc += 2;
+#define SUPER_SEARCH_ZERO \
+    if (pc[2] != 0) { \
+        mem = (Cell*) scan(mem, pc[1]); \
+    } else { \
+        while (*mem != 0) \
+            mem += pc[1]; \
+    } \
+    pc += 3;
+#define SUPER_SET_MULTIPLIER \
+    mult = mem[OFFSET16(pc[1])] * (Cell) VALUE16(pc[1]); \
+    mem[OFFSET16(pc[1])] = 0; \
+    pc += 2;
+#define SUPER_CALC_MULT \
+    mem[OFFSET16(pc[1])] += mult * (Cell) VALUE16(pc[1]); \
+    pc += 2;
+#define SUPER_MEM_MOVE \
+    mem[pc[1] + VALUE16(pc[2] >> 16)] += mem[pc[1]] * VALUE16(pc[2]); \
+    mem[pc[1]] = 0; \
+    pc += 3;
+// after a superinstruction that did not jump
+#define SUPER_NEXT \
+    NEXT_LABEL;
+
+// the superinstruction starting at every pc as assign_supers() gives
+// them, without the ones over a wide record, which SUPER_* cannot read
+template <typename Cell>
+void packed_supers(const std::vector<Instruction> &insns, std::vector<int> &starts) {
+    assign_supers(insns, SUPERINSTRUCTIONS, SUPER_COUNT, starts);
+    for (size_t pc = 0; pc < insns.size(); ++pc) {
+        if (starts[pc] == 0)
+            continue;
+        for (int i = 0; i < SUPERINSTRUCTIONS[starts[pc] - 1].length; ++i) {
+            if (!packs<Cell>(insns[pc + i], false))
+                starts[pc] = 0;
+        }
+    }
+}
+
+// runs bytecode, made from insns, from insns[start]; with a tier, counts
+// the back edges of every loop and lets it replace hot loops with native
+// code; with a profile, the heads of loops get handlers that count into
+// it. Without either, sequences of instructions bf-super-table.h lists run
+// as superinstructions unless super is false.
+// The first run threads the code, and with membuf NULL does only that;
+// later runs, which take super as the first one did, only read it when
+// there is no tier, and may share it between threads.
+template <typename Cell>
+void execute(Bytecode<Cell> &bytecode, const std::vector<Instruction> &insns, size_t start,
+        Cell *membuf, IO *io, LoopCompiler *tier = NULL, LoopProfile *profile = NULL,
+        bool super = true) {
+    Word *code = bytecode.code;
+    const std::vector<size_t> &at = bytecode.at;
+    const std::vector<size_t> &index = bytecode.index;
+    ScanFunc scan = bytecode.scan;
+    char *base = (char*) &&LABEL_END;
+    std::vector<unsigned> counts(tier != NULL ? insns.size() : 0);
+    std::vector<NativeLoop> natives(tier != NULL ? insns.size() : 0);
+    // in the order of Handler
+    void *handlers[] = {
+        &&LABEL_GET, &&LABEL_PUT, &&LABEL_OPEN, &&LABEL_CLOSE, &&LABEL_CALC, &&LABEL_CALC_WIDE,
+        &&LABEL_MOVE, &&LABEL_LOAD, &&LABEL_LOAD_WIDE, &&LABEL_MEM_MOVE, &&LABEL_SEARCH_ZERO,
+        &&LABEL_SCAN, &&LABEL_SET_MULTIPLIER, &&LABEL_SET_MULTIPLIER_WIDE, &&LABEL_CALC_MULT,
+        &&LABEL_CALC_MULT_WIDE, &&LABEL_END,
+        &&LABEL_CLOSE_COUNT, &&LABEL_OPEN_PROFILE, &&LABEL_CLOSE_PROFILE, &&LABEL_MEM_MOVE_PROFILE,
+        &&LABEL_SET_MULTIPLIER_PROFILE, &&LABEL_SEARCH_ZERO_PROFILE, &&LABEL_SCAN_PROFILE,
+    };
+    if (!bytecode.threaded) {
+        for (size_t pc = 0; pc < insns.size(); ++pc)
+            code[at[pc]] = (Word) ((char*) handlers[code[at[pc]]] - base);
+        if (super && tier == NULL && profile == NULL) {
+            void *supers[] = { SUPER_LABELS };
+            std::vector<int> starts;
+            packed_supers<Cell>(insns, starts);
+            for (size_t pc = 0; pc < insns.size(); ++pc) {
+                if (starts[pc] != 0)
+                    code[at[pc]] = (Word) ((char*) supers[starts[pc] - 1] - base);
+            }
+        }
+        bytecode.threaded = true;
+    }
+    if (membuf == NULL)
+        return;
+    Cell *mem = membuf;
+    Cell mult = 0;
+    Word *pc = code + at[start];
+
+#define NEXT_LABEL \
+    goto *(void*) (base + *pc)
+
+    NEXT_LABEL;
+LABEL_GET:
+    mem[pc[1]] = io_get(io);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_PUT:
+    io_put(io, mem[pc[1]]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_OPEN:
+    if (mem[pc[1]] == 0)
+        pc = *(Target*) (pc + 2);
+    else
+        pc += 2 + TARGET_WORDS;
+    NEXT_LABEL;
+LABEL_CLOSE:
+    pc = *(Target*) (pc + 1);
+    NEXT_LABEL;
+LABEL_CLOSE_COUNT:
+    if (++counts[index[pc - code]] == tier->threshold) {
+        Word *head = *(Target*) (pc + 1);
+        size_t open = index[head - code];
+        if (NativeLoop native = tier->compile(open)) {
+            natives[open] = native;
+            *head = (Word) ((char*) &&LABEL_NATIVE - base);
+        }
+    }
+    pc = *(Target*) (pc + 1);
+    NEXT_LABEL;
+LABEL_NATIVE:
+    // runs the loop to its end and continues after its CLOSE
+    mem = (Cell*) natives[index[pc - code]](mem);
+    pc = *(Target*) (pc + 2);
+    NEXT_LABEL;
+LABEL_CALC:
+    mem[OFFSET16(pc[1])] += VALUE16(pc[1]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_CALC_WIDE:
+    mem[pc[1]] += pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_MOVE:
+    mem += pc[1];
+    pc += 2;
+    NEXT_LABEL;
+LABEL_LOAD:
+    mem[OFFSET16(pc[1])] = VALUE16(pc[1]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_LOAD_WIDE:
+    mem[pc[1]] = pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_MEM_MOVE:
+    mem[pc[1] + VALUE16(pc[2] >> 16)] += mem[pc[1]] * VALUE16(pc[2]);
+    mem[pc[1]] = 0;
+    pc += 3;
+    NEXT_LABEL;
+LABEL_SEARCH_ZERO: {
+    int stride = pc[1];
+    while (*mem != 0) {
+        mem += stride;
+    }
+    pc += 3;
+    NEXT_LABEL;
+}
+LABEL_SCAN:
+    mem = (Cell*) scan(mem, pc[1]);
+    pc += 3;
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER:
+    mult = mem[OFFSET16(pc[1])] * (Cell) VALUE16(pc[1]);
+    mem[OFFSET16(pc[1])] = 0;
+    pc += 2;
+    NEXT_LABEL;
+LABEL_SET_MULTIPLIER_WIDE:
+    mult = mem[pc[1]] * (Cell) pc[2];
+    mem[pc[1]] = 0;
+    pc += 3;
+    NEXT_LABEL;
+LABEL_CALC_MULT:
+    mem[OFFSET16(pc[1])] += mult * (Cell) VALUE16(pc[1]);
+    pc += 2;
+    NEXT_LABEL;
+LABEL_CALC_MULT_WIDE:
+    mem[pc[1]] += mult * (Cell) pc[2];
+    pc += 3;
+    NEXT_LABEL;
+LABEL_OPEN_PROFILE: {
+    LoopProfile &loop = profile[index[pc - code]];
+    ++loop.entries;
+    loop.start = __rdtsc();
+    if (mem[pc[1]] == 0) {
+        loop.cycles += __rdtsc() - loop.start;
+        pc = *(Target*) (pc + 2);
+    } else {
+        ++loop.iterations;
+        pc += 2 + TARGET_WORDS;
+    }
+    NEXT_LABEL;
+}
+LABEL_CLOSE_PROFILE: {
+    // tests the cell itself and goes back past the OPEN
+    Word *head = *(Target*) (pc + 1);
+    LoopProfile &loop = profile[index[head - code]];
+    if (mem[head[1]] != 0) {
+        ++loop.iterations;
+        pc = head + 2 + TARGET_WORDS;
+    } else {
+        loop.cycles += __rdtsc() - loop.start;
+        pc += 1 + TARGET_WORDS;
+    }
+    NEXT_LABEL;
+}
+LABEL_MEM_MOVE_PROFILE:
+    ++profile[index[pc - code]].entries;
+    profile[index[pc - code]].iterations += mem[pc[1]];
+    goto LABEL_MEM_MOVE;
+LABEL_SET_MULTIPLIER_PROFILE:
+    ++profile[index[pc - code]].entries;
+    profile[index[pc - code]].iterations += (Cell) (mem[pc[1]] * (Cell) pc[2]);
+    goto LABEL_SET_MULTIPLIER_WIDE;
+LABEL_SEARCH_ZERO_PROFILE: {
+    LoopProfile &loop = profile[index[pc - code]];
+    Cell *from = mem;
+    ++loop.entries;
+    loop.start = __rdtsc();
+    while (*mem != 0) {
+        mem += pc[1];
+    }
+    loop.cycles += __rdtsc() - loop.start;
+    loop.iterations += (mem - from) / pc[1];
+    pc += 3;
+    NEXT_LABEL;
+}
+LABEL_SCAN_PROFILE: {
+    LoopProfile &loop = profile[index[pc - code]];
+    Cell *from = mem;
+    ++loop.entries;
+    loop.start = __rdtsc();
+    mem = (Cell*) scan(mem, pc[1]);
+    loop.cycles += __rdtsc() - loop.start;
+    loop.iterations += (mem - from) / pc[1];
+    pc += 3;
+    NEXT_LABEL;
+}
+SUPER_HANDLERS
+LABEL_END:
+    io_flush(io);
+}
+// runs insns from insns[start] on bytecode of their own
+template <typename Cell>
+void execute(const std::vector<Instruction> &insns, size_t start, Cell *membuf, IO *io,
+        LoopCompiler *tier = NULL, LoopProfile *profile = NULL, bool super = true) {
+    Bytecode<Cell> bytecode(insns, tier != NULL, profile);
+    execute<Cell>(bytecode, insns, start, membuf, io, tier, profile, super);
+}
+#endif